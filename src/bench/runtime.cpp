@@ -0,0 +1,494 @@
+#include "xi/core/latency_histogram.h"
+#include "xi/core/parker.h"
+#include "xi/core/scheduler.h"
+#include "xi/hw/hardware.h"
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace xi;
+using namespace xi::core::v2;
+
+/// Microbenchmarks for the v2 scheduler.
+///
+/// Every worker count gets a scheduler of its own, started in a forked
+/// child since workers never exit. Children send their results back over
+/// a pipe and the parent prints everything as a single JSON document, so
+/// that runs can be diffed against a baseline.
+
+namespace {
+  enum : u64 {
+    SPAWN_COUNT           = 200'000,
+    YIELDERS_PER_WORKER   = 16,
+    YIELDS_PER_RESUMABLE  = 2'000,
+    PING_PONG_HOPS        = 20'000,
+    SLEEPERS              = 2'000,
+    NETPOLL_ROUNDS        = 2'000,
+    IDLE_WAKEUP_ROUNDS    = 200,
+    IDLE_WAKEUP_SETTLE_US = 2'000,
+  };
+
+  u64 now_ns() {
+    return duration_cast< nanoseconds >(steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  /// Lets the main thread wait for resumables without spinning on the
+  /// cores the workers run on
+  class completion {
+    atomic< u64 > _left{0};
+    parker _parker;
+
+  public:
+    void expect(u64 n) {
+      _left.store(n, memory_order_release);
+    }
+
+    void finish() {
+      if (1 == _left.fetch_sub(1, memory_order_acq_rel)) {
+        _parker.unpark();
+      }
+    }
+
+    void wait() {
+      while (_left.load(memory_order_acquire) > 0) {
+        _parker.park();
+      }
+    }
+  };
+
+  struct measurement {
+    string name;
+    usize workers;
+    u64 ops;
+    nanoseconds elapsed;
+    /// Per operation latency, empty when the case only measures
+    /// throughput
+    vector< u64 > samples;
+  };
+
+  struct context {
+    mut< scheduler > s;
+    usize workers;
+    completion done;
+    vector< u64 > samples;
+  };
+
+  /// Completes as soon as it runs
+  struct spawned : public resumable {
+    mut< context > cx;
+
+    spawned(mut< context > cx) : cx(cx) {
+    }
+
+    result resume(mut< execution_budget >) override {
+      cx->done.finish();
+      return done{};
+    }
+    void yield(result) override {
+    }
+  };
+
+  /// Reschedules itself, sampling how long each trip through the ready
+  /// queue took
+  struct yielder : public resumable {
+    mut< context > cx;
+    usize first_sample;
+    u64 yields     = 0;
+    u64 yielded_at = 0;
+
+    yielder(mut< context > cx, usize first_sample)
+        : cx(cx), first_sample(first_sample) {
+    }
+
+    result resume(mut< execution_budget >) override {
+      auto now = now_ns();
+      if (yielded_at) {
+        cx->samples[first_sample + yields - 1] = now - yielded_at;
+      }
+      if (yields++ == YIELDS_PER_RESUMABLE) {
+        cx->done.finish();
+        return done{};
+      }
+      yielded_at = now_ns();
+      return reschedule{};
+    }
+    void yield(result) override {
+    }
+  };
+
+  /// Bounces between the first and the last worker, each hop enqueueing
+  /// the next one on the other side
+  struct hop : public resumable {
+    mut< context > cx;
+    u64 index;
+    u64 sent_at;
+
+    hop(mut< context > cx, u64 index) : cx(cx), index(index) {
+      affinity_hint(affinity::worker(index % 2 ? cx->workers - 1 : 0));
+      sent_at = now_ns();
+    }
+
+    result resume(mut< execution_budget >) override {
+      cx->samples[index] = now_ns() - sent_at;
+      if (index + 1 < PING_PONG_HOPS) {
+        cx->s->central_enqueue(own< resumable >(new hop(cx, index + 1)));
+      } else {
+        cx->done.finish();
+      }
+      return done{};
+    }
+    void yield(result) override {
+    }
+  };
+
+  /// Sleeps once, sampling how late it woke up
+  struct sleeper : public resumable {
+    mut< context > cx;
+    usize index;
+    nanoseconds duration;
+    u64 due_at = 0;
+
+    sleeper(mut< context > cx, usize index, nanoseconds duration)
+        : cx(cx), index(index), duration(duration) {
+    }
+
+    result resume(mut< execution_budget >) override {
+      auto now = now_ns();
+      if (!due_at) {
+        due_at = now + duration.count();
+        return blocked::sleep{duration};
+      }
+      cx->samples[index] = now > due_at ? now - due_at : 0;
+      cx->done.finish();
+      return done{};
+    }
+    void yield(result) override {
+    }
+  };
+
+  /// Waits on its end of a socketpair for timestamps sent by the main
+  /// thread, sampling how long the netpoller took to resume it
+  struct receiver : public resumable {
+    mut< context > cx;
+    i32 fd;
+    usize first_sample;
+    u64 received = 0;
+
+    receiver(mut< context > cx, i32 fd, usize first_sample)
+        : cx(cx), fd(fd), first_sample(first_sample) {
+    }
+
+    result resume(mut< execution_budget >) override {
+      u64 sent_at;
+      while (::read(fd, &sent_at, sizeof(sent_at)) == sizeof(sent_at)) {
+        cx->samples[first_sample + received++] = now_ns() - sent_at;
+        cx->done.finish();
+      }
+      if (received == NETPOLL_ROUNDS) {
+        return done{};
+      }
+      return blocked::port{fd, blocked::port::READ};
+    }
+    void yield(result) override {
+    }
+  };
+
+  /// Samples the time from enqueueing until it runs
+  struct wakeup : public resumable {
+    mut< context > cx;
+    usize index;
+    u64 sent_at;
+
+    wakeup(mut< context > cx, usize index)
+        : cx(cx), index(index), sent_at(now_ns()) {
+    }
+
+    result resume(mut< execution_budget >) override {
+      cx->samples[index] = now_ns() - sent_at;
+      cx->done.finish();
+      return done{};
+    }
+    void yield(result) override {
+    }
+  };
+
+  /// Samples are allocated before the clock starts
+  template < class F >
+  measurement run_case(
+      mut< context > cx, string name, u64 ops, usize samples, F&& body) {
+    cx->samples.assign(samples, 0);
+    cx->done.expect(0);
+    auto start = now_ns();
+    body();
+    cx->done.wait();
+    auto elapsed = nanoseconds(now_ns() - start);
+    return {move(name), cx->workers, ops, elapsed, move(cx->samples)};
+  }
+
+  measurement bench_spawn(mut< context > cx) {
+    return run_case(cx, "spawn", SPAWN_COUNT, 0, [&] {
+      cx->done.expect(SPAWN_COUNT);
+      for (auto i : range::to(u64(SPAWN_COUNT))) {
+        (void)i;
+        cx->s->central_enqueue(own< resumable >(new spawned(cx)));
+      }
+    });
+  }
+
+  measurement bench_yield(mut< context > cx) {
+    auto count = YIELDERS_PER_WORKER * cx->workers;
+    auto ops   = count * YIELDS_PER_RESUMABLE;
+    return run_case(cx, "yield", ops, ops, [&] {
+      cx->done.expect(count);
+      for (auto i : range::to(count)) {
+        cx->s->central_enqueue(
+            own< resumable >(new yielder(cx, i * YIELDS_PER_RESUMABLE)));
+      }
+    });
+  }
+
+  measurement bench_ping_pong(mut< context > cx) {
+    return run_case(cx, "ping_pong", PING_PONG_HOPS, PING_PONG_HOPS, [&] {
+      cx->done.expect(1);
+      cx->s->central_enqueue(own< resumable >(new hop(cx, 0)));
+    });
+  }
+
+  measurement bench_sleep(mut< context > cx, string name, nanoseconds d) {
+    return run_case(cx, move(name), SLEEPERS, SLEEPERS, [&] {
+      cx->done.expect(SLEEPERS);
+      for (auto i : range::to(u64(SLEEPERS))) {
+        cx->s->central_enqueue(own< resumable >(new sleeper(cx, i, d)));
+      }
+    });
+  }
+
+  measurement bench_netpoll(mut< context > cx) {
+    auto pairs = cx->workers;
+    vector< array< i32, 2 > > fds(pairs);
+    for (auto&& p : fds) {
+      if (::socketpair(AF_UNIX, SOCK_STREAM, 0, p.data()) < 0) {
+        ::perror("socketpair");
+        ::exit(EXIT_FAILURE); // FIXME
+      }
+      ::fcntl(p[0], F_SETFL, ::fcntl(p[0], F_GETFL) | O_NONBLOCK);
+    }
+    auto ops    = pairs * NETPOLL_ROUNDS;
+    auto result = run_case(cx, "netpoll_wakeup", ops, ops, [&] {
+      for (auto i : range::to(pairs)) {
+        auto r = own< resumable >(
+            new receiver(cx, fds[i][0], i * NETPOLL_ROUNDS));
+        r->affinity_hint(affinity::worker(i));
+        cx->s->central_enqueue(move(r));
+      }
+      /// One timestamp per pair at a time, so that every sample is a
+      /// wakeup rather than a read of something already queued
+      for (auto round : range::to(u64(NETPOLL_ROUNDS))) {
+        (void)round;
+        cx->done.expect(pairs);
+        for (auto&& p : fds) {
+          auto sent_at = now_ns();
+          if (::write(p[1], &sent_at, sizeof(sent_at)) != sizeof(sent_at)) {
+            ::perror("write");
+            ::exit(EXIT_FAILURE); // FIXME
+          }
+        }
+        cx->done.wait();
+      }
+    });
+    for (auto&& p : fds) {
+      /// Only the receiving end was ever seen by a netpoller
+      netpoller::forget(p[0]);
+      ::close(p[0]);
+      ::close(p[1]);
+    }
+    return result;
+  }
+
+  /// Every round starts with all workers parked, so this is the cost of
+  /// unparking one of them on behalf of new work
+  measurement bench_idle_wakeup(mut< context > cx) {
+    u64 rounds = IDLE_WAKEUP_ROUNDS;
+    return run_case(cx, "idle_wakeup", rounds, rounds, [&] {
+      for (auto i : range::to(rounds)) {
+        ::usleep(IDLE_WAKEUP_SETTLE_US);
+        cx->done.expect(1);
+        cx->s->central_enqueue(own< resumable >(new wakeup(cx, i)));
+        cx->done.wait();
+      }
+    });
+  }
+
+  void append_json(mut< string > out, ref< measurement > m) {
+    char buf[512];
+    auto seconds = m.elapsed.count() / 1e9;
+    snprintf(buf,
+             sizeof(buf),
+             "{\"case\": \"%s\", \"workers\": %zu, \"ops\": %llu, "
+             "\"elapsed_ns\": %lld, \"ops_per_sec\": %.1f",
+             m.name.c_str(),
+             m.workers,
+             (unsigned long long)m.ops,
+             (long long)m.elapsed.count(),
+             seconds > 0 ? m.ops / seconds : 0.0);
+    *out += buf;
+    if (!m.samples.empty()) {
+      latency_histogram h;
+      for (auto sample : m.samples) {
+        h.record(nanoseconds(sample));
+      }
+      auto s = h.snapshot();
+      snprintf(buf,
+               sizeof(buf),
+               ", \"latency_ns\": {\"mean\": %lld, \"p50\": %lld, "
+               "\"p99\": %lld, \"p999\": %lld, \"max\": %lld}",
+               (long long)s.mean().count(),
+               (long long)s.percentile(0.5).count(),
+               (long long)s.percentile(0.99).count(),
+               (long long)s.percentile(0.999).count(),
+               (long long)s.max().count());
+      *out += buf;
+    }
+    *out += "}";
+  }
+
+  /// Runs in the forked child, results go out as one JSON object per line
+  [[noreturn]] void run_all(usize workers, i32 out) {
+    auto s = make< scheduler >();
+    s->start(0, workers);
+
+    context cx{edit(s), workers};
+
+    vector< measurement > results;
+    results.push_back(bench_spawn(edit(cx)));
+    results.push_back(bench_yield(edit(cx)));
+    results.push_back(bench_ping_pong(edit(cx)));
+    results.push_back(bench_sleep(edit(cx), "sleep_100us", 100us));
+    results.push_back(bench_sleep(edit(cx), "sleep_1ms", 1ms));
+    results.push_back(bench_sleep(edit(cx), "sleep_10ms", 10ms));
+    results.push_back(bench_netpoll(edit(cx)));
+    results.push_back(bench_idle_wakeup(edit(cx)));
+
+    string lines;
+    for (auto&& m : results) {
+      append_json(edit(lines), m);
+      lines += "\n";
+    }
+    for (usize written = 0; written < lines.size();) {
+      auto r = ::write(out, lines.data() + written, lines.size() - written);
+      if (r < 0) {
+        ::perror("write");
+        ::_exit(EXIT_FAILURE);
+      }
+      written += r;
+    }
+    /// Workers never return, don't wait for them
+    ::_exit(EXIT_SUCCESS);
+  }
+
+  opt< string > run_forked(usize workers) {
+    i32 fds[2];
+    if (::pipe(fds) < 0) {
+      ::perror("pipe");
+      ::exit(EXIT_FAILURE); // FIXME
+    }
+    auto pid = ::fork();
+    if (pid < 0) {
+      ::perror("fork");
+      ::exit(EXIT_FAILURE); // FIXME
+    }
+    if (pid == 0) {
+      ::close(fds[0]);
+      run_all(workers, fds[1]);
+    }
+    ::close(fds[1]);
+    string lines;
+    char buf[4096];
+    for (;;) {
+      auto r = ::read(fds[0], buf, sizeof(buf));
+      if (r <= 0) {
+        break;
+      }
+      lines.append(buf, r);
+    }
+    ::close(fds[0]);
+    i32 status = 0;
+    ::waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+      return none;
+    }
+    return some(move(lines));
+  }
+
+  void usage(const char* self) {
+    fprintf(stderr,
+            "usage: %s [-w max_workers] [-o output.json]\n"
+            "Runs every case at 1, 2, 4, ... up to max_workers workers, "
+            "which defaults to the number of cpus\n",
+            self);
+  }
+}
+
+int
+main(int argc, char* argv[]) {
+  usize max_workers = hw::enumerate().cpus().size();
+  const char* output = nullptr;
+  for (i32 opt; (opt = ::getopt(argc, argv, "w:o:h")) != -1;) {
+    switch (opt) {
+      case 'w':
+        max_workers = ::strtoul(optarg, nullptr, 10);
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+  if (max_workers == 0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  vector< usize > counts;
+  for (usize n = 1; n < max_workers; n *= 2) {
+    counts.push_back(n);
+  }
+  counts.push_back(max_workers);
+
+  string json = "{\"benchmark\": \"xi_bench_runtime\", \"max_workers\": " +
+                to_string(max_workers) + ", \"results\": [\n";
+  auto first = true;
+  for (auto n : counts) {
+    fprintf(stderr, "running with %zu workers\n", n);
+    auto lines = run_forked(n);
+    if (!lines.is_some()) {
+      fprintf(stderr, "run with %zu workers failed\n", n);
+      return EXIT_FAILURE;
+    }
+    auto all = lines.unwrap();
+    for (usize pos = 0, end; (end = all.find('\n', pos)) != string::npos;
+         pos = end + 1) {
+      json += first ? "  " : ",\n  ";
+      json += all.substr(pos, end - pos);
+      first = false;
+    }
+  }
+  json += "\n]}\n";
+
+  auto f = output ? ::fopen(output, "w") : stdout;
+  if (!f) {
+    ::perror("fopen");
+    return EXIT_FAILURE;
+  }
+  fputs(json.c_str(), f);
+  if (output) {
+    ::fclose(f);
+  }
+  return EXIT_SUCCESS;
+}
@@ -1,9 +1,12 @@
 #include "xi/core/netpoller.h"
+#include "xi/core/detail/netpoller_impl.h"
 #include "xi/core/resumable.h"
 #include "xi/core/runtime.h"
+#include "xi/util/spin_lock.h"
 
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
+#include <sys/timerfd.h>
 
 namespace xi {
 namespace core {
@@ -11,69 +14,267 @@ namespace core {
     namespace {
       enum { MAX_EVENTS = 1024 };
       thread_local epoll_event EVENTS[MAX_EVENTS];
+
+      /// Event data is either the address of one of our own fds, a
+      /// watched netpoller tagged in the lowest bit, or a registered fd
+      /// shifted up and tagged in the second lowest bit
+      enum : u64 { WATCHED_TAG = 1, FD_TAG = 2, TAG_BITS = 2 };
+
+      /// Lazily allocated table indexed by fd. Entries never move, so
+      /// they may be looked up from other threads while it grows.
+      template < class T >
+      class fd_table {
+        enum : usize {
+          CHUNK_BITS = 12,
+          CHUNK_SIZE = 1 << CHUNK_BITS,
+          CHUNK_MASK = CHUNK_SIZE - 1,
+          CHUNKS     = 1 << 10,
+        };
+        array< atomic< T* >, CHUNKS > _chunks = {};
+
+      public:
+        ~fd_table() {
+          for (auto&& c : _chunks) {
+            delete[] c.load(memory_order_relaxed);
+          }
+        }
+
+        T& operator[](i32 fd) {
+          assert(fd >= 0 && static_cast< usize >(fd) < CHUNK_SIZE * CHUNKS);
+          auto&& slot = _chunks[fd >> CHUNK_BITS];
+          auto chunk  = slot.load(memory_order_acquire);
+          if (XI_UNLIKELY(!chunk)) {
+            auto fresh = new T[CHUNK_SIZE]();
+            if (slot.compare_exchange_strong(chunk, fresh)) {
+              chunk = fresh;
+            } else {
+              delete[] fresh;
+            }
+          }
+          return chunk[fd & CHUNK_MASK];
+        }
+      };
+
+      /// Bumped whenever a port is closed, so that registrations of a
+      /// previous incarnation of the fd are not mistaken for current ones
+      fd_table< atomic< u32 > > FD_GENERATIONS;
+
+      u32 generation_of(i32 fd) {
+        /// Zero is reserved for never registered
+        return FD_GENERATIONS[fd].load(memory_order_acquire) + 1;
+      }
+
+      /// Marks an fd as ready while nobody is waiting on it
+      resumable* const READY = reinterpret_cast< resumable* >(1);
+
+      enum {
+        DEFAULT_QUEUE_DEPTH     = 1024,
+        DEFAULT_SQ_POLL_IDLE_MS = 1000,
+      };
     }
 
-    class netpoller::impl {
+    netpoller::config netpoller::DEFAULT_CONFIG = {
+        // backend kind;
+#ifdef XI_HAS_IO_URING
+        netpoller::backend::IO_URING,
+#else
+        netpoller::backend::EPOLL,
+#endif
+        // u32 queue_depth;
+        DEFAULT_QUEUE_DEPTH,
+        // bool sq_poll;
+        false,
+        // u32 sq_poll_idle_ms;
+        DEFAULT_SQ_POLL_IDLE_MS,
+    };
+
+    class epoll_netpoller final : public netpoller::impl {
+      /// Each fd is registered once for both directions, edge triggered,
+      /// and readiness is matched with waiters here. Waiters may be taken
+      /// by whoever polls on our behalf, hence atomics.
+      struct interest {
+        atomic< resumable* > reader{nullptr};
+        atomic< resumable* > writer{nullptr};
+        /// Owner only
+        u32 generation = 0;
+      };
+
       i32 _epoll     = -1;
       i32 _wakeup_fd = -1;
+      i32 _timer_fd  = -1;
+      /// Deadline the timer is currently armed for, if any
+      steady_clock::time_point _armed = steady_clock::time_point::max();
+      /// Also decremented by whoever polls on our behalf
+      atomic< usize > _pending{0};
+      fd_table< interest > _interests;
+      /// Waiters on fds that were already ready, owner only
+      worker_queue _ready;
+      /// Netpollers we may currently poll on behalf of. Held while
+      /// draining them, so that nobody is still at it once unwatch
+      /// returns.
+      spin_lock _watch_lock;
+      vector< netpoller::impl* > _watched;
 
     public:
-      impl();
-      void await_readable(resumable* r, i32 fd);
-      void await_writable(resumable* r, i32 fd);
-      usize poll_into(mut< worker_queue > queue, usize n, bool block);
-      void unblock_one();
+      epoll_netpoller();
+      void await_readable(resumable* r, i32 fd) override;
+      void await_writable(resumable* r, i32 fd) override;
+      usize poll_into(mut< worker_queue > queue,
+                      usize n,
+                      bool block,
+                      bool on_behalf) override;
+      usize poll_until(mut< worker_queue > queue,
+                       usize n,
+                       steady_clock::time_point deadline) override;
+      void flush() override;
+      usize pending() const override;
+      i32 native_handle() const override;
+      void unblock_one() override;
+      void watch(netpoller::impl* other);
+      void unwatch(netpoller::impl* other);
+
+    private:
+      /// Returns the number of events, rather than of resumables
+      usize _poll_events(mut< worker_queue > queue,
+                         usize n,
+                         bool block,
+                         bool on_behalf);
+      void _await(resumable* r, i32 fd, atomic< resumable* > interest::*);
+      void _register(i32 fd, interest&);
+      static usize _wake(atomic< resumable* >&, mut< worker_queue >);
+      void _arm_timer(steady_clock::time_point deadline);
     };
 
-    netpoller::impl::impl()
+    epoll_netpoller::epoll_netpoller()
         : _epoll(::epoll_create1(EPOLL_CLOEXEC))
-        , _wakeup_fd(::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) {
+        , _wakeup_fd(::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+        , _timer_fd(
+              ::timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)) {
       epoll_event ev;
-      ev.events  = EPOLLIN | EPOLLET;
-      ev.data.fd = _wakeup_fd;
+      ev.events   = EPOLLIN | EPOLLET;
+      ev.data.ptr = &_wakeup_fd;
       if (::epoll_ctl(_epoll, EPOLL_CTL_ADD, _wakeup_fd, &ev) == -1) {
         ::perror("epoll_ctl: wakeup_fd");
         ::exit(EXIT_FAILURE); // FIXME
       }
+      ev.data.ptr = &_timer_fd;
+      if (::epoll_ctl(_epoll, EPOLL_CTL_ADD, _timer_fd, &ev) == -1) {
+        ::perror("epoll_ctl: timer_fd");
+        ::exit(EXIT_FAILURE); // FIXME
+      }
     }
 
-    void netpoller::impl::await_readable(resumable* r, i32 fd) {
-      epoll_event ev;
-      ev.events   = EPOLLIN | EPOLLET | EPOLLONESHOT;
-      ev.data.ptr = r;
-      auto ret    = epoll_ctl(_epoll, EPOLL_CTL_MOD, fd, &ev);
-      if (-1 == ret && errno == ENOENT) {
-        ret = epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &ev);
-        if (-1 == ret) {
-          if (errno == EEXIST) {
-            return;
+    void epoll_netpoller::await_readable(resumable* r, i32 fd) {
+      _await(r, fd, &interest::reader);
+    }
+
+    void epoll_netpoller::await_writable(resumable* r, i32 fd) {
+      _await(r, fd, &interest::writer);
+    }
+
+    void epoll_netpoller::_await(resumable* r,
+                                 i32 fd,
+                                 atomic< resumable* > interest::*direction) {
+      auto&& i = _interests[fd];
+      if (XI_UNLIKELY(i.generation != generation_of(fd))) {
+        _register(fd, i);
+      }
+      auto&& waiter = i.*direction;
+      auto expected = waiter.load(memory_order_acquire);
+      for (;;) {
+        if (expected == READY) {
+          /// Readiness arrived while nobody was waiting, no need to
+          /// wait for it again
+          if (waiter.compare_exchange_weak(expected, nullptr)) {
+            return _ready.enqueue(own< resumable >{r});
           }
-          perror("epoll_ctl: await_readable");
-          exit(EXIT_FAILURE);
+          continue;
+        }
+        if (XI_UNLIKELY(expected != nullptr)) {
+          /// Readiness is matched with a single waiter per direction,
+          /// another one would take its place and never be resumed
+          ::fprintf(stderr,
+                    "netpoller: fd %d already has a %s waiter\n",
+                    fd,
+                    direction == &interest::reader ? "read" : "write");
+          ::exit(EXIT_FAILURE); // FIXME
         }
+        _pending.fetch_add(1, memory_order_relaxed);
+        if (waiter.compare_exchange_weak(expected, r)) {
+          return;
+        }
+        _pending.fetch_sub(1, memory_order_relaxed);
       }
     }
 
-    void netpoller::impl::await_writable(resumable* r, i32 fd) {
+    /// Once per incarnation of the fd, as told apart by forget()
+    void epoll_netpoller::_register(i32 fd, interest& i) {
       epoll_event ev;
-      ev.events   = EPOLLOUT | EPOLLET | EPOLLONESHOT;
-      ev.data.ptr = r;
-      auto ret    = epoll_ctl(_epoll, EPOLL_CTL_MOD, fd, &ev);
-      if (-1 == ret && errno == ENOENT) {
-        ret = epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &ev);
-        if (-1 == ret) {
-          if (errno == EEXIST) {
-            return;
-          }
-          perror("epoll_ctl: await_writable");
-          exit(EXIT_FAILURE);
+      ev.events   = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+      ev.data.u64 = (static_cast< u64 >(fd) << TAG_BITS) | FD_TAG;
+      auto ret    = ::epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &ev);
+      if (-1 == ret && errno == EEXIST) {
+        /// Still registered under an older generation, e.g. when the fd
+        /// was closed while duplicated
+        ret = ::epoll_ctl(_epoll, EPOLL_CTL_MOD, fd, &ev);
+      }
+      if (-1 == ret) {
+        ::perror("epoll_ctl: register");
+        ::exit(EXIT_FAILURE); // FIXME
+      }
+      /// Whatever was remembered belongs to the previous incarnation
+      i.reader.store(nullptr, memory_order_relaxed);
+      i.writer.store(nullptr, memory_order_relaxed);
+      i.generation = generation_of(fd);
+    }
+
+    /// Hands the waiter over, or remembers readiness if there is none
+    usize epoll_netpoller::_wake(atomic< resumable* >& waiter,
+                                 mut< worker_queue > q) {
+      auto expected = waiter.load(memory_order_acquire);
+      for (;;) {
+        if (expected == READY) {
+          return 0;
+        }
+        auto desired = expected ? nullptr : READY;
+        if (waiter.compare_exchange_weak(expected, desired)) {
+          break;
         }
       }
+      if (!expected) {
+        return 0;
+      }
+      q->enqueue(own< resumable >{expected});
+      return 1;
     }
 
-    usize netpoller::impl::poll_into(mut< worker_queue > q,
+    usize epoll_netpoller::poll_into(mut< worker_queue > q,
                                      usize n,
-                                     bool block) {
+                                     bool block,
+                                     bool on_behalf) {
+      auto before = q->size();
+      if (on_behalf) {
+        /// Watches are edge triggered, whatever is left behind now
+        /// won't be reported again
+        while (_poll_events(q, MAX_EVENTS, false, true) == MAX_EVENTS) {
+        }
+        return q->size() - before;
+      }
+      if (!_ready.is_empty()) {
+        /// Don't go to sleep with ready waiters at hand
+        block = false;
+        while (!_ready.is_empty()) {
+          q->enqueue(_ready.dequeue().unwrap());
+        }
+      }
+      _poll_events(q, n, block, false);
+      return q->size() - before;
+    }
+
+    usize epoll_netpoller::_poll_events(mut< worker_queue > q,
+                                        usize n,
+                                        bool block,
+                                        bool on_behalf) {
       auto& events = EVENTS;
       i32 cnt      = ::epoll_wait(
           _epoll, events, min< usize >(n, MAX_EVENTS), block ? -1 : 0);
@@ -81,24 +282,158 @@ namespace core {
         return 0;
       }
       assert(cnt >= 0);
+      /// Watched netpollers reuse the event buffer, so they are
+      /// drained once we are done with it
+      static_vector< netpoller::impl*, MAX_EVENTS > ready;
       for (i32 i = 0; i < cnt; ++i) {
-        if (XI_UNLIKELY(events[i].data.fd == _wakeup_fd)) {
-          u64 val;
-          ::eventfd_read(_wakeup_fd, &val);
+        auto data = events[i].data;
+        if (XI_UNLIKELY(data.ptr == &_wakeup_fd)) {
+          if (!on_behalf) {
+            u64 val;
+            ::eventfd_read(_wakeup_fd, &val);
+          }
           continue;
         }
-        auto r = reinterpret_cast< resumable* >(events[i].data.ptr);
-        q->enqueue(own< resumable >{r});
+        if (XI_UNLIKELY(data.ptr == &_timer_fd)) {
+          if (!on_behalf) {
+            u64 expirations;
+            ::read(_timer_fd, &expirations, sizeof(expirations));
+            _armed = steady_clock::time_point::max();
+          }
+          continue;
+        }
+        if (XI_UNLIKELY(data.u64 & WATCHED_TAG)) {
+          ready.push_back(
+              reinterpret_cast< netpoller::impl* >(data.u64 & ~WATCHED_TAG));
+          continue;
+        }
+        assert(data.u64 & FD_TAG);
+        auto&& entry = _interests[data.u64 >> TAG_BITS];
+        auto flags   = events[i].events;
+        auto woken   = 0ul;
+        auto closed  = flags & (EPOLLERR | EPOLLHUP | EPOLLRDHUP);
+        if (flags & (EPOLLIN | EPOLLPRI) || closed) {
+          woken += _wake(entry.reader, q);
+        }
+        if (flags & EPOLLOUT || closed) {
+          woken += _wake(entry.writer, q);
+        }
+        _pending.fetch_sub(woken, memory_order_relaxed);
+      }
+      if (!ready.empty()) {
+        _watch_lock.lock();
+        XI_SCOPE(exit) {
+          _watch_lock.unlock();
+        };
+        for (auto other : ready) {
+          /// Its owner may have taken it back since
+          if (find(begin(_watched), end(_watched), other) != end(_watched)) {
+            other->poll_into(q, MAX_EVENTS, false, true);
+          }
+        }
       }
       return cnt;
     }
 
-    void netpoller::impl::unblock_one() {
+    usize epoll_netpoller::poll_until(mut< worker_queue > q,
+                                      usize n,
+                                      steady_clock::time_point deadline) {
+      _arm_timer(deadline);
+      return poll_into(q, n, true, false);
+    }
+
+    /// steady_clock is CLOCK_MONOTONIC, so the deadline can be handed to
+    /// the kernel as an absolute time without any conversion
+    void epoll_netpoller::_arm_timer(steady_clock::time_point deadline) {
+      if (deadline == _armed) {
+        return;
+      }
+      itimerspec spec = {};
+      if (deadline != steady_clock::time_point::max()) {
+        auto ns = duration_cast< nanoseconds >(deadline.time_since_epoch());
+        /// Zero would disarm the timer rather than fire it immediately
+        ns = max(ns, nanoseconds(1));
+        spec.it_value.tv_sec  = ns.count() / 1'000'000'000;
+        spec.it_value.tv_nsec = ns.count() % 1'000'000'000;
+      }
+      if (::timerfd_settime(_timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr) ==
+          -1) {
+        ::perror("timerfd_settime");
+        ::exit(EXIT_FAILURE); // FIXME
+      }
+      _armed = deadline;
+    }
+
+    /// Interest is registered with the kernel right away
+    void epoll_netpoller::flush() {
+    }
+
+    usize epoll_netpoller::pending() const {
+      return _pending.load(memory_order_relaxed);
+    }
+
+    i32 epoll_netpoller::native_handle() const {
+      return _epoll;
+    }
+
+    /// Whatever is already pending on the other one is reported right
+    /// away
+    void epoll_netpoller::watch(netpoller::impl* other) {
+      _watch_lock.lock();
+      XI_SCOPE(exit) {
+        _watch_lock.unlock();
+      };
+      if (find(begin(_watched), end(_watched), other) != end(_watched)) {
+        return;
+      }
+      epoll_event ev;
+      ev.events   = EPOLLIN | EPOLLET;
+      ev.data.u64 = reinterpret_cast< u64 >(other) | WATCHED_TAG;
+      if (::epoll_ctl(_epoll, EPOLL_CTL_ADD, other->native_handle(), &ev) ==
+          -1) {
+        ::perror("epoll_ctl: watch");
+        ::exit(EXIT_FAILURE); // FIXME
+      }
+      _watched.push_back(other);
+    }
+
+    void epoll_netpoller::unwatch(netpoller::impl* other) {
+      _watch_lock.lock();
+      XI_SCOPE(exit) {
+        _watch_lock.unlock();
+      };
+      auto it = find(begin(_watched), end(_watched), other);
+      if (it == end(_watched)) {
+        return;
+      }
+      auto fd = other->native_handle();
+      if (::epoll_ctl(_epoll, EPOLL_CTL_DEL, fd, nullptr) == -1) {
+        ::perror("epoll_ctl: unwatch");
+        ::exit(EXIT_FAILURE); // FIXME
+      }
+      _watched.erase(it);
+    }
+
+    void epoll_netpoller::unblock_one() {
       ::eventfd_write(_wakeup_fd, 1);
     }
 
-    void netpoller::start() {
-      _impl = make_shared< impl >();
+    void netpoller::forget(i32 fd) {
+      FD_GENERATIONS[fd].fetch_add(1, memory_order_release);
+    }
+
+    void netpoller::start(config c) {
+#ifdef XI_HAS_IO_URING
+      if (c.kind == backend::IO_URING) {
+        _impl = make_uring_netpoller(c);
+        if (_impl) {
+          _backend = backend::IO_URING;
+          return;
+        }
+      }
+#endif
+      _impl    = make_shared< epoll_netpoller >();
+      _backend = backend::EPOLL;
     }
 
     void netpoller::stop() {
@@ -117,12 +452,48 @@ namespace core {
 
     usize netpoller::poll_into(mut< worker_queue > q, usize n) {
       assert(_impl);
-      return _impl->poll_into(q, n, false);
+      return _impl->poll_into(q, n, false, false);
     }
 
     usize netpoller::blocking_poll_into(mut< worker_queue > q, usize n) {
       assert(_impl);
-      return _impl->poll_into(q, n, true);
+      return _impl->poll_into(q, n, true, false);
+    }
+
+    usize netpoller::blocking_poll_into(mut< worker_queue > q,
+                                        usize n,
+                                        steady_clock::time_point deadline) {
+      assert(_impl);
+      return _impl->poll_until(q, n, deadline);
+    }
+
+    void netpoller::flush() {
+      assert(_impl);
+      _impl->flush();
+    }
+
+    auto netpoller::kind() const -> backend {
+      return _backend;
+    }
+
+    usize netpoller::pending() const {
+      assert(_impl);
+      return _impl->pending();
+    }
+
+    void netpoller::watch(mut< netpoller > other) {
+      assert(_impl);
+      assert(other->_impl);
+      assert(_backend == backend::EPOLL);
+      static_cast< epoll_netpoller* >(_impl.get())->watch(other->_impl.get());
+    }
+
+    void netpoller::unwatch(mut< netpoller > other) {
+      assert(_impl);
+      assert(other->_impl);
+      assert(_backend == backend::EPOLL);
+      static_cast< epoll_netpoller* >(_impl.get())
+          ->unwatch(other->_impl.get());
     }
 
     void netpoller::unblock_one() {
@@ -0,0 +1,70 @@
+#include "xi/core/parker.h"
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace xi {
+namespace core {
+  namespace v2 {
+    namespace {
+      long futex(atomic< i32 >* addr,
+                 i32 op,
+                 i32 val,
+                 const timespec* timeout,
+                 u32 mask) {
+        static_assert(sizeof(atomic< i32 >) == sizeof(i32),
+                      "futex word must be a plain 32-bit integer");
+        return ::syscall(SYS_futex,
+                         reinterpret_cast< i32* >(addr),
+                         op | FUTEX_PRIVATE_FLAG,
+                         val,
+                         timeout,
+                         nullptr,
+                         mask);
+      }
+    }
+
+    void parker::park(steady_clock::time_point deadline) {
+      /// NOTIFIED -> EMPTY consumes a pending wakeup, EMPTY -> PARKED
+      /// announces that we are about to sleep
+      if (NOTIFIED == _state.fetch_sub(1, memory_order_acquire)) {
+        return;
+      }
+      /// FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC timeout,
+      /// which is what steady_clock is
+      timespec ts;
+      timespec* timeout = nullptr;
+      if (deadline != steady_clock::time_point::max()) {
+        auto ns    = duration_cast< nanoseconds >(deadline.time_since_epoch());
+        ts.tv_sec  = ns.count() / 1'000'000'000;
+        ts.tv_nsec = ns.count() % 1'000'000'000;
+        timeout    = &ts;
+      }
+      for (;;) {
+        auto ret = futex(&_state,
+                         FUTEX_WAIT_BITSET,
+                         PARKED,
+                         timeout,
+                         FUTEX_BITSET_MATCH_ANY);
+        i32 expected = NOTIFIED;
+        if (_state.compare_exchange_strong(
+                expected, EMPTY, memory_order_acquire, memory_order_relaxed)) {
+          return;
+        }
+        if (-1 == ret && ETIMEDOUT == errno) {
+          _state.exchange(EMPTY, memory_order_acquire);
+          return;
+        }
+        /// Spurious wakeup or EINTR, go back to sleep
+      }
+    }
+
+    void parker::unpark() {
+      if (PARKED == _state.exchange(NOTIFIED, memory_order_release)) {
+        futex(&_state, FUTEX_WAKE, 1, nullptr, 0);
+      }
+    }
+  }
+}
+}
@@ -3,6 +3,7 @@
 #include "xi/core/execution_context.h"
 #include "xi/core/runtime.h"
 #include "xi/core/resumable.h"
+#include "xi/core/stall_detector.h"
 
 #include <signal.h>
 #include <sys/epoll.h>
@@ -52,12 +53,6 @@ namespace core {
         ::pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
       }
 
-      void yield_current_task(int signo) {
-        // printf("Task quota reached.\n");
-        // xi::core::runtime.local_worker().current_resumable()->yield(
-        //     resumable::resume_later);
-      }
-
       void action(int signo, siginfo_t* siginfo, void* ignore) {
         printf("Signal %d\n", signo);
         if (signo == QUOTA_SIGNAL) {
@@ -108,17 +103,16 @@ namespace core {
       sev.sigev_notify   = SIGEV_THREAD_ID;
       sev._sigev_un._tid = syscall(SYS_gettid);
       sev.sigev_signo    = QUOTA_SIGNAL;
-      auto ret = ::timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &_quota_timer);
-      perror("timer_create");
-      assert(0 <= ret);
+      /// Wall clock rather than CPU time, a handler stuck in a blocking
+      /// call is just as much of a stall
+      if (-1 == ::timer_create(CLOCK_MONOTONIC, &sev, &_quota_timer)) {
+        ::perror("timer_create: quota_timer");
+        ::exit(EXIT_FAILURE); // FIXME
+      }
       block_all_signals();
       handle_signal(WAKEUP_SIGNAL);
       handle_signal(QUOTA_SIGNAL);
-
-      struct sigaction sa_task_quota = {};
-      sa_task_quota.sa_handler       = &yield_current_task;
-      auto r = sigaction(QUOTA_SIGNAL, &sa_task_quota, nullptr);
-      assert(r == 0);
+      stall_detector::install(QUOTA_SIGNAL);
     }
 
     epoll::~epoll() {
@@ -135,8 +129,12 @@ namespace core {
       // sigfillset(&block_all);
       // sigdelset(&block_all, WAKEUP_SIGNAL);
       // ::pthread_sigmask(SIG_SETMASK, &block_all, &active_sigmask);
+      stall_detector::report_pending(stderr);
       auto timeout = 0;
       if (ns > 0ns) {
+        /// Nothing to watch over while idle, ticking would only cut our
+        /// sleep short
+        _disarm_quota_timer();
         auto tv_nsec         = ns.count() % 1000'000'000;
         auto tv_sec          = ns.count() / 1000'000'000;
         itimerspec its       = {};
@@ -207,21 +205,38 @@ namespace core {
       ::eventfd_write(_wakeup_fd, 1);
       // pthread_kill(_thread_id, WAKEUP_SIGNAL);
     }
+    /// The timer isn't rearmed for every slice, it ticks at a fraction
+    /// of the quota and the signal handler checks how long the current
+    /// slice has been running. A slice is thus reported somewhere between
+    /// one and one and a quarter quotas in. Blocking in poll_for stops
+    /// the ticks until the next slice starts.
     void epoll::begin_task_quota_monitor(nanoseconds ns) {
-      auto tv_nsec         = ns.count() % 1000'000'000;
-      auto tv_sec          = ns.count() / 1000'000'000;
-      itimerspec its       = {};
-      its.it_value.tv_nsec = tv_nsec;
-      its.it_value.tv_sec  = tv_sec;
-      // its.it_interval      = its.it_value;
-      its.it_interval = {};
-      auto r          = timer_settime(_quota_timer, 0, &its, nullptr);
-      assert(r >= 0);
+      if (XI_UNLIKELY(ns != _armed_quota)) {
+        auto tick            = ns / 4;
+        itimerspec its       = {};
+        its.it_value.tv_nsec = tick.count() % 1000'000'000;
+        its.it_value.tv_sec  = tick.count() / 1000'000'000;
+        its.it_interval      = its.it_value;
+        auto r               = timer_settime(_quota_timer, 0, &its, nullptr);
+        assert(r >= 0);
+        _armed_quota = ns;
+      }
+      stall_detector::begin_slice();
     }
+
     void epoll::end_task_quota_monitor() {
+      stall_detector::end_slice();
+    }
+
+    /// Armed again by the next slice
+    void epoll::_disarm_quota_timer() {
+      if (_armed_quota == 0ns) {
+        return;
+      }
       itimerspec its = {};
       auto r         = timer_settime(_quota_timer, 0, &its, nullptr);
       assert(r >= 0);
+      _armed_quota = 0ns;
     }
   }
 }
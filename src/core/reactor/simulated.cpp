@@ -0,0 +1,96 @@
+#include "xi/core/reactor/simulated.h"
+#include "xi/ext/configure.h"
+#include "xi/core/resumable.h"
+#include "xi/core/runtime.h"
+#include "xi/core/simulation.h"
+
+namespace xi {
+namespace core {
+  namespace reactor {
+
+    simulated::simulated() : _id(simulation::attach()) {
+    }
+
+    simulated::~simulated() {
+      simulation::detach(_id);
+    }
+
+    void simulated::poll_for(nanoseconds ns) {
+      auto now      = simulation::now();
+      auto deadline = now;
+      if (ns > 0ns) {
+        deadline = ns < simulation::time_point::max() - now
+                       ? now + ns
+                       : simulation::time_point::max();
+      }
+      simulation::poll(_id, deadline);
+
+      vector< i32 > posted;
+      {
+        auto lock = make_unique_lock(_lock);
+        posted.swap(_posted);
+      }
+      vector< i32 > unclaimed;
+      for (auto fd : posted) {
+        auto it = _waiters.find(fd);
+        if (it == end(_waiters)) {
+          unclaimed.push_back(fd);
+          continue;
+        }
+        auto r = it->second;
+        _waiters.erase(it);
+        assert(!r->is_ready_linked());
+        r->unblock();
+      }
+      if (!unclaimed.empty()) {
+        /// Nobody waits yet, the first one to do so picks the post up.
+        /// Ahead of whatever came in meanwhile, to keep the order.
+        auto lock = make_unique_lock(_lock);
+        _posted.insert(begin(_posted), begin(unclaimed), end(unclaimed));
+      }
+    }
+
+    void simulated::await_readable(i32 fd) {
+      _await(fd);
+    }
+
+    void simulated::await_writable(i32 fd) {
+      _await(fd);
+    }
+
+    void simulated::maybe_wakeup() {
+      simulation::wake(_id);
+    }
+
+    void simulated::post(i32 fd) {
+      {
+        auto lock = make_unique_lock(_lock);
+        _posted.push_back(fd);
+      }
+      simulation::wake(_id);
+    }
+
+    void simulated::begin_task_quota_monitor(nanoseconds) {
+    }
+
+    void simulated::end_task_quota_monitor() {
+    }
+
+    /// Like epoll, a descriptor has a single waiter at a time. A post
+    /// that came before the wait is consumed without blocking.
+    void simulated::_await(i32 fd) {
+      {
+        auto lock = make_unique_lock(_lock);
+        auto it   = find(begin(_posted), end(_posted), fd);
+        if (it != end(_posted)) {
+          _posted.erase(it);
+          return;
+        }
+      }
+      auto r       = runtime.local_worker().current_resumable();
+      _waiters[fd] = r;
+      r->block();
+    }
+  }
+}
+}
@@ -3,10 +3,6 @@
 
 namespace xi {
 namespace core {
-  namespace v2 {
-    thread_local resumable_stat RESUMABLE_STAT;
-  }
-
   void resumable::attach_executor(abstract_worker* e) {
     _worker = e;
   }
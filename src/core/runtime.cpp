@@ -16,22 +16,31 @@ namespace core {
 
     public:
       void start();
+      void start_once();
       void await_termination();
       void spawn(own< resumable_builder > rb);
+      void spawn(own< resumable > r);
       void set_cores(u8);
       void sleep_current_resumable(nanoseconds ns);
       void await_readable(i32 fd);
       void await_writable(i32 fd);
+      worker_stats_snapshot stats();
+      void write_trace(::std::ostream&);
     };
 
     void runtime_environment::impl::start() {
       _schedulers.push_back(make< scheduler >());
-      // TODO : Integrate with libnuma and create a scheduler per node
+      /// A single scheduler, its workers are grouped by NUMA node
       for (auto&& s : _schedulers) {
         s->start(0, _cores);
       }
     }
 
+    /// Every spawn path has to go through the same once flag
+    void runtime_environment::impl::start_once() {
+      once::call_lambda([this] { start(); });
+    }
+
     void runtime_environment::impl::await_termination() {
       for (auto&& s : _schedulers) {
         s->join();
@@ -44,6 +53,12 @@ namespace core {
       _schedulers[idx]->central_enqueue(move(rb));
     }
 
+    void runtime_environment::impl::spawn(own< resumable > r) {
+      auto idx = _round_robin_cnt.fetch_add(1, memory_order_relaxed) %
+                 _schedulers.size();
+      _schedulers[idx]->central_enqueue(move(r));
+    }
+
     void runtime_environment::impl::set_cores(u8 count) {
       _cores = count;
     }
@@ -66,6 +81,26 @@ namespace core {
       return w->await_writable(fd);
     }
 
+    worker_stats_snapshot runtime_environment::impl::stats() {
+      worker_stats_snapshot merged;
+      for (auto&& s : _schedulers) {
+        merged.merge(s->stats());
+      }
+      return merged;
+    }
+
+    void runtime_environment::impl::write_trace(::std::ostream& out) {
+      vector< trace_thread > threads;
+      for (auto&& s : _schedulers) {
+        auto id_base = threads.size();
+        for (auto&& t : s->trace()) {
+          t.id += id_base;
+          threads.push_back(move(t));
+        }
+      }
+      write_chrome_trace(out, threads);
+    }
+
     runtime_environment::runtime_environment() : _impl(make_shared< impl >()) {
     }
 
@@ -76,10 +111,15 @@ namespace core {
     }
 
     void runtime_environment::spawn(own< resumable_builder > rb) {
-      once::call_lambda([this] { _impl->start(); });
+      _impl->start_once();
       _impl->spawn(move(rb));
     }
 
+    void runtime_environment::spawn(own< resumable > r) {
+      _impl->start_once();
+      _impl->spawn(move(r));
+    }
+
     void runtime_environment::set_cores(u8 count) {
       assert(is_valid(_impl));
       return _impl->set_cores(count);
@@ -100,6 +140,16 @@ namespace core {
       return _impl->await_writable(fd);
     }
 
+    worker_stats_snapshot runtime_environment::stats() {
+      assert(is_valid(_impl));
+      return _impl->stats();
+    }
+
+    void runtime_environment::write_trace(::std::ostream& out) {
+      assert(is_valid(_impl));
+      return _impl->write_trace(out);
+    }
+
     runtime_environment runtime;
   }
 
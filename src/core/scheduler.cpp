@@ -0,0 +1,34 @@
+#include "xi/core/scheduler.h"
+
+namespace xi {
+namespace core {
+  namespace v2 {
+    namespace {
+      enum : u64 {
+        /// About 15%
+        DEFAULT_SHRINK_BELOW = 154,
+        /// About 60%
+        DEFAULT_GROW_ABOVE    = 614,
+        DEFAULT_SUSTAIN_NS    = 5'000'000'000,
+        DEFAULT_MIN_WORKERS   = 1,
+      };
+    }
+
+    scheduler::config scheduler::DEFAULT_CONFIG = {
+        // elastic;
+        {
+            // bool enabled;
+            false,
+            // u32 shrink_below;
+            DEFAULT_SHRINK_BELOW,
+            // u32 grow_above;
+            DEFAULT_GROW_ABOVE,
+            // nanoseconds sustain;
+            nanoseconds(DEFAULT_SUSTAIN_NS),
+            // usize min_workers;
+            DEFAULT_MIN_WORKERS,
+        },
+    };
+  }
+}
+}
@@ -14,22 +14,16 @@ shard_at(u16 id) {
 namespace core {
 
   class deferred_poller : public poller {
-    deque< own< task > > _deferred_tasks;
+    mut< task_queue > _deferred_tasks;
     mut< task_queue > _task_queue;
 
   public:
-    deferred_poller(mut< task_queue > tq) : _task_queue(tq) {
-    }
-
-    void push(own< task > t) {
-      _deferred_tasks.emplace_back(move(t));
+    deferred_poller(mut< task_queue > deferred, mut< task_queue > tq)
+        : _deferred_tasks(deferred), _task_queue(tq) {
     }
 
     unsigned poll() noexcept override {
-      for (auto &&t : _deferred_tasks) {
-        _task_queue->submit(move(t));
-      }
-      _deferred_tasks.clear();
+      _task_queue->append(_deferred_tasks);
       return 0;
     }
   };
@@ -85,9 +79,8 @@ namespace core {
     _signals = edit(sig);
     register_poller(move(sig));
 
-    auto dp          = make< deferred_poller >(edit(_task_queue));
-    _deferred_poller = edit(dp);
-    register_poller(move(dp));
+    register_poller(
+        make< deferred_poller >(edit(_deferred_tasks), edit(_task_queue)));
 
     // if (bootstrap::cpus() > 1 && _buses) {
     //   register_poller(make< message_bus_poller >(_core_id, _buses));
@@ -163,8 +156,7 @@ namespace core {
       // , so we must use a common input queue
       _push_task_to_inbound_queue(this_shard->cpu(), move(t));
     } else {
-      // _task_queue.submit(move(t));
-      _deferred_poller->push(move(t));
+      _deferred_tasks.submit(move(t));
     }
   }
 
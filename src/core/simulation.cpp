@@ -0,0 +1,191 @@
+#include "xi/core/simulation.h"
+
+namespace xi {
+namespace core {
+  namespace {
+    enum : usize { NOBODY = numeric_limits< usize >::max() };
+
+    struct participant {
+      simulation::time_point deadline = simulation::time_point::max();
+      /// Runnable regardless of the deadline
+      bool woken    = false;
+      bool attached = true;
+      /// Has made its first poll
+      bool entered = false;
+    };
+
+    struct simulation_state {
+      mutex lock;
+      condition_variable turn_changed;
+      vector< participant > workers;
+      usize expected = 0;
+      usize turn     = NOBODY;
+      /// Written under the lock, read by whoever holds the baton or
+      /// looks from the outside
+      atomic< steady_clock::rep > now{0};
+      u64 random = 1;
+      u64 steps  = 0;
+      bool stuck = false;
+    };
+
+    /// Never destroyed, workers of a coordinator keep waiting in it
+    /// until the process is gone
+    simulation_state& STATE() {
+      static auto state = new simulation_state;
+      return *state;
+    }
+
+    /// xorshift64*, good enough to pick the next worker and the same for
+    /// a given seed everywhere
+    u64 next_random(simulation_state& s) {
+      s.random ^= s.random >> 12;
+      s.random ^= s.random << 25;
+      s.random ^= s.random >> 27;
+      return s.random * 2685821657736338717ull;
+    }
+
+    simulation::time_point now_of(simulation_state& s) {
+      return simulation::time_point(
+          steady_clock::duration(s.now.load(memory_order_relaxed)));
+    }
+
+    bool is_runnable(simulation_state& s, participant& p) {
+      return p.attached && p.entered &&
+             (p.woken || p.deadline <= now_of(s));
+    }
+
+    /// Whoever detached without polling doesn't hold anybody up
+    usize count_entered(simulation_state& s) {
+      usize n = 0;
+      for (auto&& p : s.workers) {
+        if (p.entered || !p.attached) {
+          ++n;
+        }
+      }
+      return n;
+    }
+
+    /// Called with the lock held
+    void pass_baton(simulation_state& s) {
+      s.turn = NOBODY;
+      if (count_entered(s) < s.expected) {
+        return;
+      }
+      vector< usize > runnable;
+      auto collect = [&] {
+        for (auto id : range::to(s.workers.size())) {
+          if (is_runnable(s, s.workers[id])) {
+            runnable.push_back(id);
+          }
+        }
+      };
+      collect();
+      if (runnable.empty()) {
+        auto earliest = simulation::time_point::max();
+        for (auto&& p : s.workers) {
+          if (p.attached) {
+            earliest = min(earliest, p.deadline);
+          }
+        }
+        if (earliest == simulation::time_point::max()) {
+          s.stuck = true;
+          return;
+        }
+        /// Nobody has anything to do until then
+        s.now.store(earliest.time_since_epoch().count(),
+                    memory_order_relaxed);
+        collect();
+      }
+      s.stuck = false;
+      s.turn  = runnable[next_random(s) % runnable.size()];
+      ++s.steps;
+      s.turn_changed.notify_all();
+    }
+
+    void await_turn(simulation_state& s,
+                    ::std::unique_lock< mutex >& lock,
+                    usize id) {
+      s.turn_changed.wait(lock, [&] { return s.turn == id; });
+      auto&& p   = s.workers[id];
+      p.woken    = false;
+      p.deadline = simulation::time_point::max();
+    }
+  }
+
+  void simulation::reset(u64 seed, usize workers) {
+    auto&& s  = STATE();
+    auto lock = make_unique_lock(s.lock);
+    s.workers.clear();
+    s.expected = workers;
+    s.turn     = NOBODY;
+    s.now.store(0, memory_order_relaxed);
+    auto mixed = seed ^ 0x9E3779B97F4A7C15ull;
+    /// xorshift never leaves zero
+    s.random = mixed ? mixed : 1;
+    s.steps  = 0;
+    s.stuck  = false;
+  }
+
+  simulation::time_point simulation::now() {
+    return now_of(STATE());
+  }
+
+  usize simulation::attach() {
+    auto&& s  = STATE();
+    auto lock = make_unique_lock(s.lock);
+    auto id   = s.workers.size();
+    s.workers.emplace_back();
+    return id;
+  }
+
+  void simulation::detach(usize id) {
+    auto&& s  = STATE();
+    auto lock = make_unique_lock(s.lock);
+    assert(id < s.workers.size());
+    s.workers[id].attached = false;
+    /// Might have been the last one everybody else waited for
+    if (s.turn == id || s.turn == NOBODY) {
+      pass_baton(s);
+    }
+  }
+
+  void simulation::poll(usize id, time_point deadline) {
+    auto&& s  = STATE();
+    auto lock = make_unique_lock(s.lock);
+    auto&& p  = s.workers[id];
+    assert(s.turn == id || !p.entered);
+    p.entered  = true;
+    p.deadline = deadline;
+    /// The first poll only has to hand over the baton if nobody holds it
+    if (s.turn == id || s.turn == NOBODY) {
+      pass_baton(s);
+    }
+    await_turn(s, lock, id);
+  }
+
+  void simulation::wake(usize id) {
+    auto&& s  = STATE();
+    auto lock = make_unique_lock(s.lock);
+    if (id >= s.workers.size()) {
+      return;
+    }
+    s.workers[id].woken = true;
+    /// Nobody is running to notice
+    if (s.turn == NOBODY) {
+      pass_baton(s);
+    }
+  }
+
+  u64 simulation::steps() {
+    auto&& s  = STATE();
+    auto lock = make_unique_lock(s.lock);
+    return s.steps;
+  }
+
+  bool simulation::is_stuck() {
+    auto&& s  = STATE();
+    auto lock = make_unique_lock(s.lock);
+    return s.stuck;
+  }
+}
+}
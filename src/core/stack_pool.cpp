@@ -0,0 +1,123 @@
+#include "xi/core/stack_pool.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace xi {
+namespace core {
+  namespace v2 {
+    namespace {
+      usize page_size() {
+        static const usize size = ::sysconf(_SC_PAGESIZE);
+        return size;
+      }
+
+      enum : usize {
+        DEFAULT_MAX_CACHED       = 64,
+        DEFAULT_DIRTY_HIGH_WATER = 16,
+      };
+    }
+
+    stack_pool::config stack_pool::DEFAULT_CONFIG = {
+        // usize max_cached;
+        DEFAULT_MAX_CACHED,
+        // usize dirty_high_water;
+        DEFAULT_DIRTY_HIGH_WATER,
+    };
+
+    stack_pool::stack_pool(config c) : _config(move(c)) {
+    }
+
+    stack_pool::~stack_pool() {
+      for (auto&& c : _classes) {
+        for (auto&& ctx : c.cached) {
+          _unmap(ctx);
+        }
+      }
+    }
+
+    ::boost::context::stack_context stack_pool::allocate(usize size) {
+      assert(size <= MAX_SIZE);
+      auto&& c = _classes[class_of(size)];
+      if (c.cached.empty()) {
+        ++_stats.misses;
+        return _map(size_of_class(class_of(size)));
+      }
+      ++_stats.hits;
+      auto ctx = c.cached.back();
+      c.cached.pop_back();
+      /// Clean stacks are only handed out once the dirty ones are gone
+      if (c.dirty > 0) {
+        --c.dirty;
+      }
+      return ctx;
+    }
+
+    void stack_pool::deallocate(::boost::context::stack_context& ctx) {
+      auto&& c = _classes[class_of(ctx.size)];
+      if (c.cached.size() >= _config.max_cached) {
+        ++_stats.unmapped;
+        return _unmap(ctx);
+      }
+      c.cached.push_back(ctx);
+      if (c.dirty < _config.dirty_high_water) {
+        ++c.dirty;
+        return;
+      }
+      /// The oldest dirty stack is the least likely to still be in cache,
+      /// and once trimmed it simply becomes the newest clean one
+      ++_stats.trimmed;
+      _trim(c.cached[c.cached.size() - c.dirty - 1]);
+    }
+
+    mut< stack_pool > stack_pool::local() {
+      thread_local stack_pool pool;
+      return edit(pool);
+    }
+
+    ::boost::context::stack_context stack_pool::_map(usize size) {
+      auto guard = page_size();
+      auto base  = ::mmap(nullptr,
+                         size + guard,
+                         PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                         -1,
+                         0);
+      if (MAP_FAILED == base) {
+        throw ::std::bad_alloc();
+      }
+      /// Stacks grow down, overflowing one faults on the lowest page
+      ::mprotect(base, guard, PROT_NONE);
+
+      ::boost::context::stack_context ctx;
+      ctx.size = size;
+      ctx.sp   = static_cast< char* >(base) + guard + size;
+#if defined(BOOST_USE_VALGRIND)
+      ctx.valgrind_stack_id =
+          VALGRIND_STACK_REGISTER(ctx.sp, static_cast< char* >(base) + guard);
+#endif
+      return ctx;
+    }
+
+    void stack_pool::_unmap(::boost::context::stack_context& ctx) {
+#if defined(BOOST_USE_VALGRIND)
+      VALGRIND_STACK_DEREGISTER(ctx.valgrind_stack_id);
+#endif
+      auto guard = page_size();
+      ::munmap(static_cast< char* >(ctx.sp) - ctx.size - guard,
+               ctx.size + guard);
+    }
+
+    void stack_pool::_trim(::boost::context::stack_context& ctx) {
+      auto bottom = static_cast< char* >(ctx.sp) - ctx.size;
+#if defined(MADV_FREE)
+      /// Lazily reclaimed, costs nothing if memory isn't tight
+      if (0 == ::madvise(bottom, ctx.size, MADV_FREE)) {
+        return;
+      }
+#endif
+      ::madvise(bottom, ctx.size, MADV_DONTNEED);
+    }
+  }
+}
+}
@@ -0,0 +1,206 @@
+#include "xi/core/stall_detector.h"
+
+#include <execinfo.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+namespace xi {
+namespace core {
+  namespace {
+    enum : u64 {
+      DEFAULT_QUOTA_NS               = 50'000'000,
+      DEFAULT_MIN_REPORT_INTERVAL_NS = 1'000'000'000,
+    };
+
+    enum : u8 { FREE, WRITING, READY };
+
+    struct slot {
+      atomic< u8 > state{FREE};
+      stall_detector::report report;
+    };
+
+    atomic< u64 > QUOTA_NS{DEFAULT_QUOTA_NS};
+    atomic< u64 > MIN_REPORT_INTERVAL_NS{DEFAULT_MIN_REPORT_INTERVAL_NS};
+    atomic< u64 > LAST_REPORT_NS{0};
+    atomic< u64 > PENDING{0};
+    atomic< u64 > DROPPED{0};
+    array< slot, stall_detector::SLOTS > REPORT_SLOTS;
+
+    /// Zero while the thread isn't running a slice
+    thread_local atomic< u64 > SLICE_START_NS{0};
+    thread_local atomic< bool > SLICE_REPORTED{false};
+
+    u64 now_ns() {
+      timespec ts;
+      ::clock_gettime(CLOCK_MONOTONIC, &ts);
+      return static_cast< u64 >(ts.tv_sec) * 1'000'000'000ull + ts.tv_nsec;
+    }
+
+    bool take_report_token(u64 now) {
+      auto last     = LAST_REPORT_NS.load(memory_order_relaxed);
+      auto interval = MIN_REPORT_INTERVAL_NS.load(memory_order_relaxed);
+      if (last && now - last < interval) {
+        return false;
+      }
+      return LAST_REPORT_NS.compare_exchange_strong(
+          last, now, memory_order_relaxed);
+    }
+
+    /// Reads our own memory through the kernel, so that a bogus address
+    /// fails the call rather than faulting in the signal handler
+    bool read_words(uintptr_t addr, uintptr_t* out, usize n) {
+      iovec local  = {out, n * sizeof(*out)};
+      iovec remote = {reinterpret_cast< void* >(addr), n * sizeof(*out)};
+      auto bytes   = ::process_vm_readv(::getpid(), &local, 1, &remote, 1, 0);
+      return bytes == static_cast< ssize_t >(n * sizeof(*out));
+    }
+
+    /// Follows the frame pointers, which we build with, from wherever
+    /// the signal interrupted the thread. backtrace() goes through the
+    /// unwinder, which may take locks and allocate.
+    i32 walk_frames(void* context, void** frames, i32 max) {
+      auto uc = static_cast< ucontext_t* >(context);
+#if defined(__x86_64__)
+      uintptr_t pc = uc->uc_mcontext.gregs[REG_RIP];
+      uintptr_t fp = uc->uc_mcontext.gregs[REG_RBP];
+#elif defined(__aarch64__)
+      uintptr_t pc = uc->uc_mcontext.pc;
+      uintptr_t fp = uc->uc_mcontext.regs[29];
+#else
+      return 0;
+#endif
+      i32 depth       = 0;
+      frames[depth++] = reinterpret_cast< void* >(pc);
+      while (depth < max && fp && 0 == fp % sizeof(fp)) {
+        /// Saved frame pointer of the caller, then the return address
+        uintptr_t frame[2];
+        if (!read_words(fp, frame, 2) || !frame[1]) {
+          break;
+        }
+        frames[depth++] = reinterpret_cast< void* >(frame[1]);
+        /// Callers are further up the stack, anything else means we have
+        /// walked off the chain
+        if (frame[0] <= fp) {
+          break;
+        }
+        fp = frame[0];
+      }
+      return depth;
+    }
+
+    /// Runs in signal context, only async-signal-safe calls past here
+    void on_timer(int, siginfo_t*, void* context) {
+      auto saved_errno = errno;
+      XI_SCOPE(exit) {
+        errno = saved_errno;
+      };
+      auto start = SLICE_START_NS.load(memory_order_relaxed);
+      if (!start || SLICE_REPORTED.load(memory_order_relaxed)) {
+        return;
+      }
+      auto now = now_ns();
+      if (now - start < QUOTA_NS.load(memory_order_relaxed)) {
+        return;
+      }
+      SLICE_REPORTED.store(true, memory_order_relaxed);
+      if (!take_report_token(now)) {
+        return;
+      }
+      for (auto&& s : REPORT_SLOTS) {
+        u8 expected = FREE;
+        if (!s.state.compare_exchange_strong(
+                expected, WRITING, memory_order_acquire)) {
+          continue;
+        }
+        s.report.tid     = ::syscall(SYS_gettid);
+        s.report.running = nanoseconds(now - start);
+        s.report.depth = walk_frames(
+            context, s.report.frames.data(), stall_detector::MAX_FRAMES);
+        s.state.store(READY, memory_order_release);
+        PENDING.fetch_add(1, memory_order_release);
+        return;
+      }
+      DROPPED.fetch_add(1, memory_order_relaxed);
+    }
+  }
+
+  stall_detector::config stall_detector::DEFAULT_CONFIG = {
+      // nanoseconds quota;
+      nanoseconds(DEFAULT_QUOTA_NS),
+      // nanoseconds min_report_interval;
+      nanoseconds(DEFAULT_MIN_REPORT_INTERVAL_NS),
+  };
+
+  void stall_detector::configure(config c) {
+    QUOTA_NS.store(c.quota.count(), memory_order_relaxed);
+    MIN_REPORT_INTERVAL_NS.store(c.min_report_interval.count(),
+                                 memory_order_relaxed);
+  }
+
+  nanoseconds stall_detector::quota() {
+    return nanoseconds(QUOTA_NS.load(memory_order_relaxed));
+  }
+
+  void stall_detector::install(i32 signo) {
+    struct sigaction sa = {};
+    sa.sa_sigaction     = &on_timer;
+    ::sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    if (-1 == ::sigaction(signo, &sa, nullptr)) {
+      ::perror("sigaction: stall_detector");
+      ::exit(EXIT_FAILURE); // FIXME
+    }
+  }
+
+  void stall_detector::begin_slice() {
+    SLICE_REPORTED.store(false, memory_order_relaxed);
+    SLICE_START_NS.store(now_ns(), memory_order_relaxed);
+    atomic_signal_fence(memory_order_seq_cst);
+  }
+
+  void stall_detector::end_slice() {
+    atomic_signal_fence(memory_order_seq_cst);
+    SLICE_START_NS.store(0, memory_order_relaxed);
+  }
+
+  usize stall_detector::drain(function< void(ref< report >) > f) {
+    if (!PENDING.load(memory_order_acquire)) {
+      return 0;
+    }
+    usize cnt = 0;
+    for (auto&& s : REPORT_SLOTS) {
+      /// Claimed while copying, so that two drainers don't both take it
+      u8 expected = READY;
+      if (!s.state.compare_exchange_strong(
+              expected, WRITING, memory_order_acquire)) {
+        continue;
+      }
+      auto r = s.report;
+      s.state.store(FREE, memory_order_release);
+      PENDING.fetch_sub(1, memory_order_relaxed);
+      f(r);
+      ++cnt;
+    }
+    return cnt;
+  }
+
+  void stall_detector::report_pending(FILE* out) {
+    drain([out](auto&& r) {
+      ::fprintf(out,
+                "Thread %d stalled, slice running for %ldus:\n",
+                r.tid,
+                static_cast< long >(r.running.count() / 1000));
+      ::fflush(out);
+      ::backtrace_symbols_fd(r.frames.data(), r.depth, ::fileno(out));
+    });
+  }
+
+  u64 stall_detector::dropped() {
+    return DROPPED.load(memory_order_relaxed);
+  }
+}
+}
@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+
+#include "xi/core/coroutine_resumable.h"
+
+using namespace xi;
+using xi::core::v2::coroutine_resumable;
+using xi::core::v2::execution_budget;
+using xi::core::v2::resumable;
+using xi::core::v2::task;
+namespace co = xi::core::v2;
+
+namespace {
+  using blocked = resumable::blocked;
+
+  template < class T >
+  bool holds(ref< resumable::result > r) {
+    return nullptr != boost::get< T >(&r);
+  }
+
+  task blocks_then_finishes(i32 fd, mut< i32 > steps) {
+    ++*steps;
+    co_await co::readable(fd);
+    ++*steps;
+    co_await co::writable(fd);
+    ++*steps;
+    co_await co::sleep_for(5ms);
+    ++*steps;
+    co_await co::reschedule();
+    ++*steps;
+  }
+
+  struct fake_future {
+    bool ready = false;
+
+    bool is_ready() const {
+      return ready;
+    }
+  };
+
+  task waits_for(mut< fake_future > f, mut< bool > finished) {
+    co_await co::ready(*f);
+    *finished = true;
+  }
+
+  task checks_budget(i32 rounds, mut< i32 > ran) {
+    for (i32 i = 0; i < rounds; ++i) {
+      ++*ran;
+      co_await co::maybe_reschedule();
+    }
+  }
+}
+
+TEST(coroutine_resumable, suspends_with_each_awaited_result) {
+  i32 steps = 0;
+  coroutine_resumable r(blocks_then_finishes(7, edit(steps)));
+  /// Doesn't run before the first resume
+  ASSERT_EQ(0, steps);
+
+  auto result = r.resume(nullptr);
+  ASSERT_TRUE(holds< blocked::port >(result));
+  ASSERT_EQ(7, boost::get< blocked::port >(result).fd);
+  ASSERT_EQ(blocked::port::READ, boost::get< blocked::port >(result).type);
+  ASSERT_EQ(1, steps);
+
+  result = r.resume(nullptr);
+  ASSERT_TRUE(holds< blocked::port >(result));
+  ASSERT_EQ(blocked::port::WRITE, boost::get< blocked::port >(result).type);
+
+  result = r.resume(nullptr);
+  ASSERT_TRUE(holds< blocked::sleep >(result));
+  ASSERT_EQ(nanoseconds(5ms), boost::get< blocked::sleep >(result).duration);
+
+  ASSERT_TRUE(holds< resumable::reschedule >(r.resume(nullptr)));
+  ASSERT_TRUE(holds< resumable::done >(r.resume(nullptr)));
+  ASSERT_EQ(5, steps);
+}
+
+TEST(coroutine_resumable, polls_futures_until_ready) {
+  fake_future f;
+  bool finished = false;
+  coroutine_resumable r(waits_for(edit(f), edit(finished)));
+  ASSERT_TRUE(holds< resumable::reschedule >(r.resume(nullptr)));
+  ASSERT_TRUE(holds< resumable::reschedule >(r.resume(nullptr)));
+  ASSERT_FALSE(finished);
+
+  f.ready = true;
+  ASSERT_TRUE(holds< resumable::done >(r.resume(nullptr)));
+  ASSERT_TRUE(finished);
+}
+
+TEST(coroutine_resumable, reschedules_only_once_the_budget_is_spent) {
+  i32 ran = 0;
+  coroutine_resumable r(checks_budget(3, edit(ran)));
+  execution_budget spent(0ns);
+  ASSERT_TRUE(holds< resumable::reschedule >(r.resume(edit(spent))));
+  ASSERT_EQ(1, ran);
+
+  execution_budget plenty(1h);
+  ASSERT_TRUE(holds< resumable::done >(r.resume(edit(plenty))));
+  ASSERT_EQ(3, ran);
+}
@@ -0,0 +1,52 @@
+#include <gtest/gtest.h>
+
+#include "xi/core/latency_histogram.h"
+
+using namespace xi;
+using xi::core::v2::latency_histogram;
+using xi::core::v2::latency_snapshot;
+using xi::core::v2::log_linear_buckets;
+
+TEST(buckets, every_value_falls_within_its_bucket) {
+  for (u64 v = 0; v < (1 << 20); v = v * 5 / 4 + 1) {
+    auto idx = log_linear_buckets::index_of(v);
+    ASSERT_LE(log_linear_buckets::lower_bound_of(idx), v);
+    ASSERT_GE(log_linear_buckets::upper_bound_of(idx), v);
+    /// Relative error stays within one sub-bucket
+    ASSERT_LE(log_linear_buckets::upper_bound_of(idx) -
+                  log_linear_buckets::lower_bound_of(idx),
+              v / log_linear_buckets::SUB_BUCKETS);
+  }
+}
+
+TEST(buckets, huge_values_end_up_in_the_last_bucket) {
+  ASSERT_EQ(log_linear_buckets::BUCKETS - 1,
+            log_linear_buckets::index_of(numeric_limits< u64 >::max()));
+}
+
+TEST(histogram, percentiles_are_close) {
+  latency_histogram h;
+  for (auto i : range::to(1000)) {
+    h.record(nanoseconds(1000 + i));
+  }
+  h.record(10ms);
+  auto s = h.snapshot();
+  ASSERT_EQ(1001UL, s.total);
+  ASSERT_EQ(10ms, s.max());
+  auto p50 = s.percentile(0.5).count();
+  ASSERT_GE(p50, 1500);
+  ASSERT_LE(p50, 1500 * 9 / 8);
+  ASSERT_EQ(10ms, s.percentile(1.0));
+}
+
+TEST(histogram, snapshots_merge) {
+  latency_histogram a, b;
+  a.record(100ns);
+  b.record(200ns);
+  b.record(300ns);
+  auto s = a.snapshot();
+  s.merge(b.snapshot());
+  ASSERT_EQ(3UL, s.total);
+  ASSERT_EQ(200ns, s.mean());
+  ASSERT_EQ(300ns, s.max());
+}
@@ -0,0 +1,210 @@
+#include <gtest/gtest.h>
+
+#include "xi/core/netpoller.h"
+
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace xi;
+using xi::core::v2::resumable;
+using xi::core::v2::netpoller;
+using xi::core::v2::worker_queue;
+using xi::core::v2::execution_budget;
+
+/// Counts registrations the netpoller makes with the kernel
+atomic< usize > EPOLL_CTL_CALLS{0};
+
+extern "C" int epoll_ctl(int epfd, int op, int fd, struct epoll_event* ev) {
+  EPOLL_CTL_CALLS.fetch_add(1);
+  return ::syscall(SYS_epoll_ctl, epfd, op, fd, ev);
+}
+
+struct noop_resumable : public resumable {
+  result resume(mut< execution_budget >) override {
+    return done{};
+  }
+  void yield(result) override {
+  }
+};
+
+class netpoller_test : public ::testing::TestWithParam< netpoller::backend > {
+protected:
+  netpoller poller;
+  i32 fds[2];
+
+  void SetUp() override {
+    auto c = netpoller::DEFAULT_CONFIG;
+    c.kind = GetParam();
+    poller.start(c);
+    ASSERT_EQ(0, ::pipe(fds));
+  }
+
+  void TearDown() override {
+    ::close(fds[0]);
+    ::close(fds[1]);
+  }
+};
+
+TEST_P(netpoller_test, readiness_resumes_waiter) {
+  worker_queue q;
+  auto r   = make< noop_resumable >();
+  auto raw = r.get();
+  poller.await_readable(fds[0], move(r));
+  ASSERT_EQ(1UL, poller.pending());
+  poller.poll_into(edit(q), 16);
+  ASSERT_TRUE(q.is_empty());
+
+  ASSERT_EQ(1, ::write(fds[1], "x", 1));
+  poller.blocking_poll_into(edit(q), 16);
+  ASSERT_EQ(raw, q.dequeue().unwrap().get());
+  ASSERT_EQ(0UL, poller.pending());
+}
+
+TEST_P(netpoller_test, readiness_before_wait_is_not_lost) {
+  worker_queue q;
+  ASSERT_EQ(1, ::write(fds[1], "x", 1));
+  auto r   = make< noop_resumable >();
+  auto raw = r.get();
+  poller.await_readable(fds[0], move(r));
+  poller.blocking_poll_into(edit(q), 16);
+  ASSERT_EQ(raw, q.dequeue().unwrap().get());
+}
+
+TEST_P(netpoller_test, reused_fd_is_registered_again) {
+  worker_queue q;
+  poller.await_readable(fds[0], make< noop_resumable >());
+  ASSERT_EQ(1, ::write(fds[1], "x", 1));
+  poller.blocking_poll_into(edit(q), 16);
+  ASSERT_EQ(1UL, q.size());
+  q.dequeue();
+
+  /// Same fd numbers, different pipe
+  netpoller::forget(fds[0]);
+  netpoller::forget(fds[1]);
+  ::close(fds[0]);
+  ::close(fds[1]);
+  ASSERT_EQ(0, ::pipe(fds));
+
+  auto r   = make< noop_resumable >();
+  auto raw = r.get();
+  poller.await_readable(fds[0], move(r));
+  ASSERT_EQ(1, ::write(fds[1], "y", 1));
+  poller.blocking_poll_into(edit(q), 16);
+  ASSERT_EQ(raw, q.dequeue().unwrap().get());
+}
+
+TEST(netpoller_registration_test, fd_is_registered_once_per_incarnation) {
+  netpoller poller;
+  auto c = netpoller::DEFAULT_CONFIG;
+  c.kind = netpoller::backend::EPOLL;
+  poller.start(c);
+  i32 fds[2];
+  ASSERT_EQ(0, ::pipe(fds));
+  worker_queue q;
+
+  auto before = EPOLL_CTL_CALLS.load();
+  for ([[gnu::unused]] auto i : range::to(10)) {
+    poller.await_readable(fds[0], make< noop_resumable >());
+    ASSERT_EQ(1, ::write(fds[1], "x", 1));
+    poller.blocking_poll_into(edit(q), 16);
+    ASSERT_EQ(1UL, q.size());
+    q.dequeue();
+    char buf;
+    ASSERT_EQ(1, ::read(fds[0], &buf, 1));
+  }
+  ASSERT_EQ(1UL, EPOLL_CTL_CALLS.load() - before);
+
+  /// Same fd numbers, different pipe
+  netpoller::forget(fds[0]);
+  netpoller::forget(fds[1]);
+  ::close(fds[0]);
+  ::close(fds[1]);
+  ASSERT_EQ(0, ::pipe(fds));
+  poller.await_readable(fds[0], make< noop_resumable >());
+  ASSERT_EQ(2UL, EPOLL_CTL_CALLS.load() - before);
+
+  netpoller::forget(fds[0]);
+  netpoller::forget(fds[1]);
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+
+TEST(netpoller_death_test, second_waiter_is_rejected) {
+  netpoller poller;
+  auto c = netpoller::DEFAULT_CONFIG;
+  c.kind = netpoller::backend::EPOLL;
+  poller.start(c);
+  i32 fds[2];
+  ASSERT_EQ(0, ::pipe(fds));
+  poller.await_readable(fds[0], make< noop_resumable >());
+  ASSERT_DEATH(poller.await_readable(fds[0], make< noop_resumable >()),
+               "already has a read waiter");
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+
+TEST_P(netpoller_test, blocking_poll_returns_at_deadline) {
+  worker_queue q;
+  auto deadline = steady_clock::now() + 5ms;
+  poller.blocking_poll_into(edit(q), 16, deadline);
+  ASSERT_GE(steady_clock::now(), deadline);
+  ASSERT_TRUE(q.is_empty());
+}
+
+TEST_P(netpoller_test, unblock_one_wakes_blocked_poll) {
+  worker_queue q;
+  thread t([&] {
+    ::usleep(1000);
+    poller.unblock_one();
+  });
+  poller.blocking_poll_into(edit(q), 16);
+  t.join();
+  ASSERT_TRUE(q.is_empty());
+}
+
+TEST_P(netpoller_test, poll_counts_resumables_only) {
+  worker_queue q;
+  poller.await_readable(fds[0], make< noop_resumable >());
+  poller.unblock_one();
+  ASSERT_EQ(0UL, poller.blocking_poll_into(edit(q), 16));
+  ASSERT_EQ(1, ::write(fds[1], "x", 1));
+  ASSERT_EQ(1UL, poller.blocking_poll_into(edit(q), 16));
+  ASSERT_EQ(1UL, q.size());
+}
+
+TEST_P(netpoller_test, watcher_polls_only_while_watching) {
+  netpoller watcher;
+  auto c = netpoller::DEFAULT_CONFIG;
+  c.kind = netpoller::backend::EPOLL;
+  watcher.start(c);
+
+  worker_queue q;
+  auto r   = make< noop_resumable >();
+  auto raw = r.get();
+  poller.await_readable(fds[0], move(r));
+  poller.flush();
+  watcher.watch(edit(poller));
+  ASSERT_EQ(1, ::write(fds[1], "x", 1));
+  ASSERT_EQ(1UL, watcher.blocking_poll_into(edit(q), 16));
+  ASSERT_EQ(raw, q.dequeue().unwrap().get());
+  char buf;
+  ASSERT_EQ(1, ::read(fds[0], &buf, 1));
+
+  watcher.unwatch(edit(poller));
+  r   = make< noop_resumable >();
+  raw = r.get();
+  poller.await_readable(fds[0], move(r));
+  poller.flush();
+  ASSERT_EQ(1, ::write(fds[1], "y", 1));
+  ASSERT_EQ(0UL,
+            watcher.blocking_poll_into(
+                edit(q), 16, steady_clock::now() + 5ms));
+  poller.blocking_poll_into(edit(q), 16);
+  ASSERT_EQ(raw, q.dequeue().unwrap().get());
+}
+
+INSTANTIATE_TEST_CASE_P(backends,
+                        netpoller_test,
+                        ::testing::Values(netpoller::backend::EPOLL,
+                                          netpoller::backend::IO_URING));
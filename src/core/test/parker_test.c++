@@ -0,0 +1,43 @@
+#include <gtest/gtest.h>
+
+#include "xi/core/parker.h"
+
+using namespace xi;
+using xi::core::v2::parker;
+
+TEST(simple, unpark_before_park_is_not_lost) {
+  parker p;
+  p.unpark();
+  p.park();
+}
+
+TEST(simple, park_returns_at_deadline) {
+  parker p;
+  auto deadline = steady_clock::now() + 5ms;
+  p.park(deadline);
+  ASSERT_GE(steady_clock::now(), deadline);
+}
+
+TEST(simple, wakeup_is_consumed_by_park) {
+  parker p;
+  p.unpark();
+  p.unpark();
+  p.park();
+  auto deadline = steady_clock::now() + 1ms;
+  p.park(deadline);
+  ASSERT_GE(steady_clock::now(), deadline);
+}
+
+TEST(concurrent, unpark_wakes_parked_thread) {
+  parker p;
+  atomic< bool > woken{false};
+  thread t([&] {
+    p.park();
+    woken.store(true);
+  });
+  while (!woken.load()) {
+    p.unpark();
+    ::std::this_thread::sleep_for(1ms);
+  }
+  t.join();
+}
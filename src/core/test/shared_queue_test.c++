@@ -0,0 +1,126 @@
+#include <gtest/gtest.h>
+
+#include "xi/core/shared_queue.h"
+
+using namespace xi;
+using xi::core::v2::resumable;
+using xi::core::v2::shared_queue;
+using xi::core::v2::worker_queue;
+using xi::core::v2::execution_budget;
+
+struct tagged_resumable : public resumable {
+  usize tag;
+
+  tagged_resumable(usize t) : tag(t) {
+  }
+
+  result resume(mut< execution_budget >) override {
+    return done{};
+  }
+  void yield(result) override {
+  }
+};
+
+usize
+tag_of(own< resumable > r) {
+  return static_cast< tagged_resumable* >(r.get())->tag;
+}
+
+TEST(simple, drain_preserves_push_order) {
+  shared_queue q;
+  ASSERT_TRUE(q.is_empty());
+  for (auto i : range::to(10ul)) {
+    q.enqueue(own< resumable >{make< tagged_resumable >(i)});
+  }
+  ASSERT_FALSE(q.is_empty());
+  worker_queue out;
+  ASSERT_EQ(10UL, q.dequeue_into(edit(out), 0));
+  ASSERT_TRUE(q.is_empty());
+  ASSERT_EQ(10UL, out.size());
+  for (auto i : range::to(10ul)) {
+    ASSERT_EQ(i, tag_of(out.dequeue().unwrap()));
+  }
+}
+
+TEST(simple, queue_is_reusable_after_draining) {
+  shared_queue q;
+  worker_queue out;
+  for (auto i : range::to(3ul)) {
+    q.enqueue(own< resumable >{make< tagged_resumable >(i)});
+    ASSERT_EQ(1UL, q.dequeue_into(edit(out), 0));
+    ASSERT_TRUE(q.is_empty());
+  }
+  ASSERT_EQ(3UL, out.size());
+  while (out.dequeue().is_some()) {
+  }
+}
+
+TEST(concurrent, every_item_arrives_exactly_once_in_order) {
+  enum { PER_PRODUCER = 20000, PRODUCERS = 4 };
+  shared_queue q;
+  vector< thread > producers;
+  for (auto p : range::to< usize >(PRODUCERS)) {
+    producers.emplace_back([&q, p] {
+      for (auto i : range::to< usize >(PER_PRODUCER)) {
+        q.enqueue(own< resumable >{
+            make< tagged_resumable >(p * PER_PRODUCER + i)});
+      }
+    });
+  }
+  vector< usize > next(PRODUCERS, 0);
+  usize received = 0;
+  worker_queue out;
+  while (received < PRODUCERS * PER_PRODUCER) {
+    q.dequeue_into(edit(out), 0);
+    while (!out.is_empty()) {
+      auto tag = tag_of(out.dequeue().unwrap());
+      auto p   = tag / PER_PRODUCER;
+      ASSERT_EQ(next[p], tag % PER_PRODUCER);
+      ++next[p];
+      ++received;
+    }
+  }
+  for (auto&& t : producers) {
+    t.join();
+  }
+  ASSERT_TRUE(q.is_empty());
+}
+
+TEST(concurrent, nothing_is_stranded_once_producers_stop) {
+  enum { PER_PRODUCER = 5000, PRODUCERS = 4, ROUNDS = 20 };
+  for ([[gnu::unused]] auto round : range::to< usize >(ROUNDS)) {
+    shared_queue q;
+    atomic< bool > producing{true};
+    vector< thread > producers;
+    for ([[gnu::unused]] auto p : range::to< usize >(PRODUCERS)) {
+      producers.emplace_back([&q] {
+        for (auto i : range::to< usize >(PER_PRODUCER)) {
+          q.enqueue(own< resumable >{make< tagged_resumable >(i)});
+        }
+      });
+    }
+    /// Drain while producers race with the consumer
+    usize received = 0;
+    worker_queue out;
+    thread consumer([&] {
+      while (producing.load()) {
+        received += q.dequeue_into(edit(out), 0);
+      }
+    });
+    for (auto&& t : producers) {
+      t.join();
+    }
+    producing.store(false);
+    consumer.join();
+    /// No push follows, whatever is left has to be visible now
+    if (received < PRODUCERS * PER_PRODUCER) {
+      ASSERT_FALSE(q.is_empty());
+    }
+    received += q.dequeue_into(edit(out), 0);
+    ASSERT_EQ(usize(PRODUCERS * PER_PRODUCER), received);
+    ASSERT_EQ(received, out.size());
+    ASSERT_TRUE(q.is_empty());
+    while (out.dequeue().is_some()) {
+    }
+  }
+}
@@ -0,0 +1,72 @@
+#include <gtest/gtest.h>
+
+#include "xi/core/coordinator.h"
+#include "xi/core/policy/worker_isolation.h"
+#include "xi/core/simulation.h"
+
+using namespace xi;
+using xi::core::coordinator;
+using xi::core::resumable;
+using xi::core::simulation;
+using xi::core::policy::simulated_worker_isolation;
+
+namespace {
+  /// Sleeps for its period a few times and records the virtual time
+  /// it gets to run at
+  struct sleeper : public resumable {
+    nanoseconds period;
+    i32 sleeps_left;
+    mut< vector< nanoseconds > > trace;
+    mut< atomic< i32 > > running;
+
+    sleeper(nanoseconds p,
+            i32 n,
+            mut< vector< nanoseconds > > t,
+            mut< atomic< i32 > > r)
+        : period(p), sleeps_left(n), trace(t), running(r) {
+    }
+
+    resume_result resume() override {
+      trace->push_back(simulation::now().time_since_epoch());
+      if (sleeps_left-- == 0) {
+        running->fetch_sub(1);
+        return done;
+      }
+      /// Queued to wake up, yield() has nothing to switch away from
+      sleep_for(period);
+      return blocked;
+    }
+
+    void yield(resume_result) override {
+    }
+  };
+}
+
+/// Workers never return from run(), so this has to be the only test in
+/// its binary and the coordinator is left running
+TEST(simulated_coordinator, sleepers_run_on_virtual_time) {
+  simulation::reset(11, 2);
+  auto c     = new coordinator< simulated_worker_isolation >;
+  auto start = steady_clock::now();
+  c->start(2);
+
+  vector< nanoseconds > hourly, daily;
+  atomic< i32 > running{2};
+  c->schedule(new sleeper(hours(1), 4, edit(hourly), edit(running)));
+  c->schedule(new sleeper(hours(24), 2, edit(daily), edit(running)));
+  while (running.load() > 0) {
+    ::std::this_thread::yield();
+  }
+
+  /// Each was scheduled from outside, at whatever virtual time the
+  /// simulation had got to by then
+  ASSERT_EQ(5UL, hourly.size());
+  for (auto i : range::to(hourly.size() - 1)) {
+    ASSERT_EQ(nanoseconds(hours(1)), hourly[i + 1] - hourly[i]);
+  }
+  ASSERT_EQ(3UL, daily.size());
+  for (auto i : range::to(daily.size() - 1)) {
+    ASSERT_EQ(nanoseconds(hours(24)), daily[i + 1] - daily[i]);
+  }
+  ASSERT_LT(steady_clock::now() - start, 10s);
+}
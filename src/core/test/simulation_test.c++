@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+
+#include "xi/core/simulation.h"
+
+using namespace xi;
+using xi::core::simulation;
+
+namespace {
+  /// Each worker sleeps for its own period a few times and records when
+  /// it woke up
+  vector< pair< usize, nanoseconds > > run_sleepers(u64 seed) {
+    vector< pair< usize, nanoseconds > > trace;
+    mutex lock;
+    vector< thread > threads;
+    simulation::reset(seed, 3);
+    for (auto period : {7ms, 3ms, 5ms}) {
+      threads.emplace_back([&, period] {
+        auto id = simulation::attach();
+        for (auto i = 0; i < 4; ++i) {
+          simulation::poll(id, simulation::now() + period);
+          auto guard = make_unique_lock(lock);
+          trace.emplace_back(id, simulation::now().time_since_epoch());
+        }
+        simulation::detach(id);
+      });
+    }
+    for (auto&& t : threads) {
+      t.join();
+    }
+    return trace;
+  }
+}
+
+TEST(simple, time_jumps_to_the_deadline) {
+  simulation::reset(1, 1);
+  auto id = simulation::attach();
+  auto start = steady_clock::now();
+  simulation::poll(id, simulation::now() + hours(24));
+  ASSERT_EQ(hours(24), simulation::now().time_since_epoch());
+  ASSERT_LT(steady_clock::now() - start, 1s);
+  simulation::detach(id);
+}
+
+TEST(simple, sleepers_wake_in_deadline_order) {
+  auto trace = run_sleepers(42);
+  ASSERT_EQ(12UL, trace.size());
+  for (auto i : range::to(trace.size() - 1)) {
+    ASSERT_LE(trace[i].second, trace[i + 1].second);
+  }
+  ASSERT_EQ(nanoseconds(28ms), trace.back().second);
+}
+
+TEST(simple, same_seed_same_interleaving) {
+  vector< vector< usize > > runs;
+  for (auto attempt = 0; attempt < 2; ++attempt) {
+    simulation::reset(7, 2);
+    vector< usize > order;
+    vector< thread > threads;
+    for (auto n = 0; n < 2; ++n) {
+      threads.emplace_back([&] {
+        auto id = simulation::attach();
+        for (auto i = 0; i < 50; ++i) {
+          simulation::wake(id);
+          simulation::poll(id, simulation::time_point::max());
+          /// Only whoever holds the baton gets here
+          order.push_back(id);
+        }
+        simulation::detach(id);
+      });
+    }
+    for (auto&& t : threads) {
+      t.join();
+    }
+    runs.push_back(move(order));
+  }
+  ASSERT_EQ(100UL, runs[0].size());
+  ASSERT_EQ(runs[0], runs[1]);
+}
+
+TEST(simple, outside_wake_gets_a_stuck_worker_going) {
+  simulation::reset(3, 1);
+  atomic< bool > done{false};
+  thread worker([&] {
+    auto id = simulation::attach();
+    simulation::poll(id, simulation::time_point::max());
+    done.store(true);
+    simulation::detach(id);
+  });
+  while (!simulation::is_stuck()) {
+    ::std::this_thread::yield();
+  }
+  ASSERT_FALSE(done.load());
+  simulation::wake(0);
+  worker.join();
+  ASSERT_TRUE(done.load());
+  ASSERT_EQ(nanoseconds(0), simulation::now().time_since_epoch());
+}
@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+
+#include "xi/core/spin_policy.h"
+
+using namespace xi;
+using xi::core::v2::spin_policy;
+
+namespace {
+  enum : u64 { US = 1000 };
+
+  /// Spins are allowed to take up to a quarter of the time
+  spin_policy::config config() {
+    return {2, nanoseconds(100 * US), 256};
+  }
+
+  /// Arrivals at a steady pace, starting at the given time
+  u64 arrive(spin_policy& p, u64 start, u64 gap, usize count) {
+    for (usize i = 0; i < count; ++i) {
+      p.note_arrival(start + i * gap);
+    }
+    return start + (count - 1) * gap;
+  }
+}
+
+TEST(window, is_empty_without_arrivals) {
+  spin_policy p(config());
+  ASSERT_EQ(nanoseconds(0), p.window());
+  ASSERT_TRUE(p.should_idle(1));
+}
+
+TEST(window, grows_with_the_gap_between_arrivals) {
+  spin_policy p(config());
+  auto now = arrive(p, 1, 10 * US, 2);
+  ASSERT_EQ(nanoseconds(20 * US), p.window());
+
+  /// Smoothed, the window only moves towards the new gap
+  arrive(p, now + 30 * US, 30 * US, 1);
+  ASSERT_EQ(nanoseconds(25 * US), p.window());
+  arrive(p, now + 60 * US, 30 * US, 30);
+  ASSERT_LT(nanoseconds(25 * US), p.window());
+  ASSERT_GE(nanoseconds(60 * US), p.window());
+}
+
+TEST(window, is_dropped_past_the_cap) {
+  spin_policy p(config());
+  arrive(p, 1, 50 * US, 2);
+  ASSERT_EQ(nanoseconds(100 * US), p.window());
+
+  spin_policy slow(config());
+  arrive(slow, 1, 51 * US, 2);
+  ASSERT_EQ(nanoseconds(0), slow.window());
+}
+
+TEST(window, bounds_the_spin) {
+  spin_policy p(config());
+  auto now = arrive(p, 1, 10 * US, 2);
+  ASSERT_FALSE(p.should_idle(now + US));
+  ASSERT_TRUE(p.is_spinning());
+  ASSERT_FALSE(p.should_idle(now + 20 * US));
+  ASSERT_TRUE(p.should_idle(now + 21 * US));
+  ASSERT_EQ(nanoseconds(20 * US), p.end_spin(now + 21 * US));
+  ASSERT_FALSE(p.is_spinning());
+}
+
+TEST(window, collapses_while_spinning_burns_too_much) {
+  spin_policy p(config());
+  auto now = arrive(p, 1, 10 * US, 2);
+  p.should_idle(now);
+  p.end_spin(now + 20 * US);
+  /// A fifth of the interval is fine
+  p.end_interval(nanoseconds(100 * US));
+  ASSERT_EQ(nanoseconds(20 * US), p.window());
+
+  p.should_idle(now);
+  p.end_spin(now + 20 * US);
+  /// Half of it isn't, for the whole next interval
+  p.end_interval(nanoseconds(40 * US));
+  ASSERT_EQ(nanoseconds(0), p.window());
+  ASSERT_TRUE(p.should_idle(now + 30 * US));
+  p.end_spin(now + 30 * US);
+
+  p.end_interval(nanoseconds(100 * US));
+  ASSERT_EQ(nanoseconds(20 * US), p.window());
+}
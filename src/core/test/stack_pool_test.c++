@@ -0,0 +1,52 @@
+#include <gtest/gtest.h>
+
+#include "xi/core/stack_pool.h"
+
+using namespace xi;
+using xi::core::v2::stack_pool;
+
+TEST(size_classes, smallest_fitting_class_is_used) {
+  ASSERT_EQ(0UL, stack_pool::class_of(1));
+  ASSERT_EQ(0UL, stack_pool::class_of(stack_pool::size_of_class(0)));
+  ASSERT_EQ(1UL, stack_pool::class_of(stack_pool::size_of_class(0) + 1));
+  ASSERT_EQ(stack_pool::SIZE_CLASSES - 1,
+            stack_pool::class_of(stack_pool::MAX_SIZE));
+}
+
+TEST(pool, released_stacks_are_reused) {
+  stack_pool pool;
+  auto first = pool.allocate(4096);
+  ASSERT_LE(4096UL, first.size);
+  /// Usable all the way to the top
+  static_cast< char* >(first.sp)[-1] = 1;
+  auto sp = first.sp;
+  pool.deallocate(first);
+  auto second = pool.allocate(4096);
+  ASSERT_EQ(sp, second.sp);
+  ASSERT_EQ(1UL, pool.statistics().hits);
+  ASSERT_EQ(1UL, pool.statistics().misses);
+  pool.deallocate(second);
+}
+
+TEST(pool, surplus_is_trimmed_then_unmapped) {
+  stack_pool pool({2, 1});
+  vector< ::boost::context::stack_context > stacks;
+  for ([[gnu::unused]] auto i : range::to(4)) {
+    stacks.push_back(pool.allocate(stack_pool::MAX_SIZE));
+  }
+  /// Releasing the second one trims the first, the oldest dirty stack,
+  /// and the remaining two don't fit anymore
+  auto trimmed = stacks[0].sp;
+  auto dirty   = stacks[1].sp;
+  for (auto&& s : stacks) {
+    pool.deallocate(s);
+  }
+  ASSERT_EQ(1UL, pool.statistics().trimmed);
+  ASSERT_EQ(2UL, pool.statistics().unmapped);
+  auto reused = pool.allocate(stack_pool::MAX_SIZE);
+  ASSERT_EQ(dirty, reused.sp);
+  auto clean = pool.allocate(stack_pool::MAX_SIZE);
+  ASSERT_EQ(trimmed, clean.sp);
+  pool.deallocate(clean);
+  pool.deallocate(reused);
+}
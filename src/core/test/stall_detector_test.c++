@@ -0,0 +1,71 @@
+#include <gtest/gtest.h>
+
+#include "xi/core/stall_detector.h"
+
+#include <signal.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace xi;
+using xi::core::stall_detector;
+
+class stall_detector_test : public ::testing::Test {
+protected:
+  timer_t timer;
+
+  void SetUp() override {
+    auto signo = SIGRTMIN + 2;
+    stall_detector::install(signo);
+    sigevent sev       = {};
+    sev.sigev_notify   = SIGEV_THREAD_ID;
+    sev._sigev_un._tid = ::syscall(SYS_gettid);
+    sev.sigev_signo    = signo;
+    ASSERT_EQ(0, ::timer_create(CLOCK_MONOTONIC, &sev, &timer));
+    itimerspec its          = {};
+    its.it_value.tv_nsec    = 500'000;
+    its.it_interval.tv_nsec = 500'000;
+    ASSERT_EQ(0, ::timer_settime(timer, 0, &its, nullptr));
+    /// Whatever an earlier test left behind
+    stall_detector::drain([](auto&&) {});
+  }
+
+  void TearDown() override {
+    ::timer_delete(timer);
+    stall_detector::configure(stall_detector::DEFAULT_CONFIG);
+  }
+
+  static void run_slice(nanoseconds length) {
+    stall_detector::begin_slice();
+    auto until = steady_clock::now() + length;
+    while (steady_clock::now() < until) {
+    }
+    stall_detector::end_slice();
+  }
+};
+
+TEST_F(stall_detector_test, overlong_slice_is_reported_once) {
+  stall_detector::configure({2ms, 0ns});
+  run_slice(1ms);
+  ASSERT_EQ(0UL, stall_detector::drain([](auto&&) {}));
+
+  run_slice(10ms);
+  vector< stall_detector::report > reports;
+  stall_detector::drain([&](auto&& r) { reports.push_back(r); });
+  ASSERT_EQ(1UL, reports.size());
+  ASSERT_EQ(::syscall(SYS_gettid), reports[0].tid);
+  ASSERT_GE(reports[0].running, 2ms);
+  /// At least the interrupted function and somebody that called it
+  ASSERT_GE(reports[0].depth, 2);
+}
+
+TEST_F(stall_detector_test, reports_are_rate_limited) {
+  stall_detector::configure({2ms, 0ns});
+  run_slice(10ms);
+  ASSERT_EQ(1UL, stall_detector::drain([](auto&&) {}));
+
+  stall_detector::configure({2ms, 10s});
+  run_slice(10ms);
+  run_slice(10ms);
+  ASSERT_EQ(0UL, stall_detector::drain([](auto&&) {}));
+}
@@ -0,0 +1,92 @@
+#include <gtest/gtest.h>
+
+#include "xi/core/steal_queue.h"
+
+using namespace xi;
+using xi::core::v2::resumable;
+using xi::core::v2::steal_queue;
+using xi::core::v2::execution_budget;
+
+struct tagged_resumable : public resumable {
+  usize tag;
+
+  tagged_resumable(usize t) : tag(t) {
+  }
+
+  result resume(mut< execution_budget >) override {
+    return done{};
+  }
+  void yield(result) override {
+  }
+};
+
+usize
+tag_of(own< resumable > r) {
+  return static_cast< tagged_resumable* >(r.get())->tag;
+}
+
+TEST(simple, empty_queue_has_nothing_to_steal) {
+  steal_queue q;
+  ASSERT_TRUE(q.is_empty());
+  ASSERT_TRUE(q.steal().is_none());
+}
+
+TEST(simple, steal_preserves_push_order) {
+  steal_queue q;
+  for (auto i : range::to(10ul)) {
+    q.push(make< tagged_resumable >(i));
+  }
+  ASSERT_EQ(10UL, q.size());
+  for (auto i : range::to(10ul)) {
+    ASSERT_EQ(i, tag_of(q.steal().unwrap()));
+  }
+  ASSERT_TRUE(q.is_empty());
+}
+
+TEST(simple, queue_reports_full_at_capacity) {
+  steal_queue q;
+  for (auto i : range::to< usize >(steal_queue::CAPACITY)) {
+    ASSERT_FALSE(q.is_full());
+    q.push(make< tagged_resumable >(i));
+  }
+  ASSERT_TRUE(q.is_full());
+  q.steal();
+  ASSERT_FALSE(q.is_full());
+  while (q.steal().is_some()) {
+  }
+}
+
+TEST(concurrent, every_item_is_stolen_exactly_once) {
+  enum { ITEMS = 20000, THIEVES = 4 };
+  steal_queue q;
+  atomic< usize > taken[ITEMS];
+  for (auto&& t : taken) {
+    t.store(0);
+  }
+  atomic< bool > done{false};
+  vector< thread > thieves;
+  for ([[gnu::unused]] auto i : range::to< int >(THIEVES)) {
+    thieves.emplace_back([&] {
+      for (;;) {
+        auto r = q.steal();
+        if (r.is_some()) {
+          taken[tag_of(r.unwrap())].fetch_add(1);
+        } else if (done.load() && q.is_empty()) {
+          return;
+        }
+      }
+    });
+  }
+  for (auto i : range::to< usize >(ITEMS)) {
+    while (q.is_full()) {
+    }
+    q.push(make< tagged_resumable >(i));
+  }
+  done.store(true);
+  for (auto&& t : thieves) {
+    t.join();
+  }
+  for (auto&& t : taken) {
+    ASSERT_EQ(1UL, t.load());
+  }
+}
@@ -65,3 +65,62 @@ TEST(overflow, tasks_beyond_capacity_are_queued) {
   _queue.process_tasks();
   ASSERT_EQ(1UL, big_task::RUN);
 }
+
+TEST(ring, order_kept_across_chunks) {
+  task_queue _queue;
+  vector< usize > order;
+  auto count = task_queue::CHUNK_SLOTS * 3 + 5;
+  for (auto i : range::to(count)) {
+    _queue.submit([&order, i] { order.push_back(i); });
+  }
+  ASSERT_EQ(count, _queue.size());
+  _queue.process_tasks();
+  ASSERT_TRUE(_queue.is_empty());
+  ASSERT_EQ(count, order.size());
+  for (auto i : range::to(count)) {
+    ASSERT_EQ(i, order[i]);
+  }
+}
+
+TEST(ring, tasks_submitted_while_processing_run_after) {
+  task_queue _queue;
+  vector< usize > order;
+  for (auto i : range::to(usize(task_queue::CHUNK_SLOTS))) {
+    _queue.submit([&, i] {
+      order.push_back(i);
+      _queue.submit(
+          [&order, i] { order.push_back(task_queue::CHUNK_SLOTS + i); });
+    });
+  }
+  _queue.process_tasks();
+  ASSERT_EQ(2 * task_queue::CHUNK_SLOTS, order.size());
+  for (auto i : range::to(order.size())) {
+    ASSERT_EQ(i, order[i]);
+  }
+}
+
+TEST(ring, append_moves_tasks_in_order) {
+  task_queue _queue, _other;
+  vector< int > order;
+  _queue.submit([&] { order.push_back(1); });
+  _other.submit([&] { order.push_back(2); });
+  _other.submit(make_unique< big_task >());
+  _queue.append(edit(_other));
+  ASSERT_TRUE(_other.is_empty());
+  ASSERT_EQ(3UL, _queue.size());
+
+  auto big_runs = big_task::RUN;
+  _queue.process_tasks();
+  ASSERT_EQ((vector< int >{1, 2}), order);
+  ASSERT_EQ(big_runs + 1, big_task::RUN);
+}
+
+TEST(ring, pending_tasks_destroyed_with_queue) {
+  destructor_tracker_task::reset();
+  {
+    task_queue _queue;
+    _queue.submit(destructor_tracker_task());
+  }
+  ASSERT_EQ(1UL, destructor_tracker_task::CREATED);
+  ASSERT_EQ(2UL, destructor_tracker_task::DESTROYED);
+}
@@ -0,0 +1,131 @@
+#include <gtest/gtest.h>
+
+#include "xi/core/timer_wheel.h"
+
+using namespace xi;
+using xi::core::v2::resumable;
+using xi::core::v2::timer_wheel;
+using xi::core::v2::worker_queue;
+using xi::core::v2::execution_budget;
+
+struct tagged_resumable : public resumable {
+  usize tag;
+
+  tagged_resumable(usize t) : tag(t) {
+  }
+
+  result resume(mut< execution_budget >) override {
+    return done{};
+  }
+  void yield(result) override {
+  }
+};
+
+using wheel = timer_wheel< 10 >; // ~1us ticks
+
+vector< usize >
+drain(mut< worker_queue > q) {
+  vector< usize > tags;
+  while (!q->is_empty()) {
+    auto r = q->dequeue().unwrap();
+    tags.push_back(static_cast< tagged_resumable* >(r.get())->tag);
+  }
+  return tags;
+}
+
+TEST(simple, empty_wheel_has_no_next_item) {
+  wheel w;
+  ASSERT_TRUE(w.is_empty());
+  ASSERT_EQ(steady_clock::time_point::max(), w.next_item());
+}
+
+TEST(simple, nothing_fires_before_wakeup_time) {
+  wheel w;
+  worker_queue q;
+  auto base = steady_clock::now();
+  w.enqueue(base + 100us, make< tagged_resumable >(1));
+  w.dequeue_into(edit(q), base + 99us);
+  ASSERT_TRUE(q.is_empty());
+  ASSERT_LE(w.next_item(), base + 100us + wheel::resolution());
+  w.dequeue_into(edit(q), base + 100us + wheel::resolution());
+  ASSERT_EQ(vector< usize >{1}, drain(edit(q)));
+  ASSERT_TRUE(w.is_empty());
+}
+
+TEST(simple, items_fire_in_deadline_order_across_levels) {
+  wheel w;
+  worker_queue q;
+  auto base = steady_clock::now();
+  vector< nanoseconds > delays = {5s, 10us, 70ms, 300us, 2s, 1ms};
+  for (auto i : range::to(delays.size())) {
+    w.enqueue(base + delays[i], make< tagged_resumable >(i));
+  }
+  ASSERT_EQ(delays.size(), w.size());
+
+  vector< usize > fired;
+  for (auto now = base; !w.is_empty(); now += 50us) {
+    w.dequeue_into(edit(q), now);
+    for (auto tag : drain(edit(q))) {
+      ASSERT_GE(now, base + delays[tag]);
+      ASSERT_LE(now, base + delays[tag] + wheel::resolution() + 50us);
+      fired.push_back(tag);
+    }
+  }
+  ASSERT_EQ((vector< usize >{1, 3, 5, 2, 4, 0}), fired);
+}
+
+TEST(simple, long_jump_fires_everything_due) {
+  wheel w;
+  worker_queue q;
+  auto base = steady_clock::now();
+  for (auto i : range::to(100ul)) {
+    w.enqueue(base + i * 7ms, make< tagged_resumable >(i));
+  }
+  w.dequeue_into(edit(q), base + 1h);
+  ASSERT_EQ(100UL, drain(edit(q)).size());
+  ASSERT_TRUE(w.is_empty());
+}
+
+TEST(simple, far_items_survive_the_wheel_range) {
+  wheel w;
+  worker_queue q;
+  auto base = steady_clock::now();
+  w.enqueue(base + 1h, make< tagged_resumable >(7));
+  w.dequeue_into(edit(q), base + 59min);
+  ASSERT_TRUE(q.is_empty());
+  w.dequeue_into(edit(q), base + 1h + wheel::resolution());
+  ASSERT_EQ(vector< usize >{7}, drain(edit(q)));
+}
+
+TEST(cancel, cancelled_items_never_fire) {
+  wheel w;
+  worker_queue q;
+  auto base = steady_clock::now();
+  auto r    = make< tagged_resumable >(1);
+  auto raw  = r.get();
+  w.enqueue(base + 10ms, move(r));
+  w.enqueue(base + 20ms, make< tagged_resumable >(2));
+  auto back = w.cancel(raw);
+  ASSERT_EQ(raw, back.get());
+  ASSERT_EQ(1UL, w.size());
+  w.dequeue_into(edit(q), base + 1s);
+  ASSERT_EQ(vector< usize >{2}, drain(edit(q)));
+}
+
+TEST(simple, drain_keeps_wakeup_times) {
+  wheel w;
+  auto base = steady_clock::now();
+  vector< nanoseconds > delays = {10us, 5s, 70ms};
+  for (auto i : range::to(delays.size())) {
+    w.enqueue(base + delays[i], make< tagged_resumable >(i));
+  }
+  usize drained = 0;
+  w.drain([&](own< resumable > r) {
+    auto tag = static_cast< tagged_resumable* >(r.get())->tag;
+    ASSERT_EQ(base + delays[tag], r->wakeup_time());
+    ++drained;
+  });
+  ASSERT_EQ(delays.size(), drained);
+  ASSERT_TRUE(w.is_empty());
+  ASSERT_EQ(steady_clock::time_point::max(), w.next_item());
+}
@@ -0,0 +1,48 @@
+#include <gtest/gtest.h>
+
+#include <sstream>
+
+#include "xi/core/trace.h"
+
+using namespace xi;
+using xi::core::v2::trace_ring;
+using xi::core::v2::trace_kind;
+using xi::core::v2::trace_thread;
+
+TEST(ring, keeps_events_in_order) {
+  trace_ring ring;
+  ring.record(trace_kind::RESUME, 1);
+  ring.record(trace_kind::DONE, 0);
+  auto events = ring.snapshot();
+  ASSERT_EQ(2UL, events.size());
+  ASSERT_EQ(static_cast< u8 >(trace_kind::RESUME), events[0].kind);
+  ASSERT_EQ(1UL, events[0].arg);
+  ASSERT_LE(events[0].timestamp_ns, events[1].timestamp_ns);
+}
+
+TEST(ring, overwrites_oldest_events) {
+  trace_ring ring;
+  for (auto i : range::to< u64 >(trace_ring::CAPACITY + 10)) {
+    ring.record(trace_kind::NETPOLL, i);
+  }
+  auto events = ring.snapshot();
+  ASSERT_EQ(static_cast< usize >(trace_ring::CAPACITY), events.size());
+  ASSERT_EQ(10UL, events.front().arg);
+  ASSERT_EQ(trace_ring::CAPACITY + 9, events.back().arg);
+}
+
+TEST(chrome, resume_becomes_a_duration) {
+  trace_ring ring;
+  ring.record(trace_kind::RESUME, 0x10);
+  ring.record(trace_kind::BLOCK_PORT, 5);
+  vector< trace_thread > threads;
+  threads.push_back({3, ring.snapshot()});
+  ::std::ostringstream out;
+  core::v2::write_chrome_trace(out, threads);
+  auto json = out.str();
+  ASSERT_NE(string::npos, json.find("\"ph\":\"B\""));
+  ASSERT_NE(string::npos, json.find("\"ph\":\"E\""));
+  ASSERT_NE(string::npos, json.find("\"fd\":5"));
+  ASSERT_NE(string::npos, json.find("\"tid\":3"));
+  ASSERT_EQ('\n', json.back());
+}
@@ -0,0 +1,74 @@
+#include <gtest/gtest.h>
+
+#include "xi/core/worker_set.h"
+
+using namespace xi;
+using xi::core::v2::worker_set;
+
+TEST(simple, membership_spans_several_words) {
+  worker_set s(200);
+  ASSERT_TRUE(s.is_empty());
+  for (auto idx : {0ul, 63ul, 64ul, 130ul, 199ul}) {
+    ASSERT_TRUE(s.insert(idx));
+    ASSERT_FALSE(s.insert(idx));
+  }
+  ASSERT_EQ(5UL, s.count());
+  ASSERT_TRUE(s.contains(64));
+  ASSERT_FALSE(s.contains(65));
+  ASSERT_FALSE(s.contains(1000));
+  ASSERT_TRUE(s.erase(64));
+  ASSERT_FALSE(s.erase(64));
+  ASSERT_EQ(4UL, s.count());
+}
+
+TEST(simple, nth_walks_members_in_index_order) {
+  worker_set s(150);
+  vector< usize > members = {3, 70, 71, 140};
+  for (auto idx : members) {
+    s.insert(idx);
+  }
+  for (auto n : range::to(members.size())) {
+    ASSERT_EQ(members[n], s.nth(n).unwrap());
+  }
+  ASSERT_TRUE(s.nth(members.size()).is_none());
+}
+
+TEST(simple, claim_among_only_takes_common_members) {
+  worker_set s(100);
+  worker_set among(100);
+  s.insert(5);
+  s.insert(90);
+  among.insert(90);
+  ASSERT_EQ(90UL, s.claim(among).unwrap());
+  ASSERT_TRUE(s.claim(among).is_none());
+  ASSERT_EQ(5UL, s.claim().unwrap());
+  ASSERT_TRUE(s.is_empty());
+}
+
+TEST(concurrent, every_member_is_claimed_exactly_once) {
+  enum { MEMBERS = 256, CLAIMERS = 4, ROUNDS = 100 };
+  worker_set s(MEMBERS);
+  for ([[gnu::unused]] auto round : range::to< int >(ROUNDS)) {
+    for (auto idx : range::to< usize >(MEMBERS)) {
+      s.insert(idx);
+    }
+    atomic< usize > claimed[MEMBERS];
+    for (auto&& c : claimed) {
+      c.store(0);
+    }
+    vector< thread > claimers;
+    for ([[gnu::unused]] auto i : range::to< int >(CLAIMERS)) {
+      claimers.emplace_back([&] {
+        for (auto idx = s.claim(); idx.is_some(); idx = s.claim()) {
+          claimed[idx.unwrap()].fetch_add(1);
+        }
+      });
+    }
+    for (auto&& t : claimers) {
+      t.join();
+    }
+    for (auto&& c : claimed) {
+      ASSERT_EQ(1UL, c.load());
+    }
+  }
+}
@@ -0,0 +1,103 @@
+#include "xi/core/trace.h"
+
+#include <iomanip>
+
+namespace xi {
+namespace core {
+  namespace v2 {
+    atomic< bool > TRACE_ENABLED{false};
+
+    namespace {
+      void write_event(::std::ostream& out,
+                       u64 tid,
+                       u64 base_ns,
+                       ref< trace_event > e) {
+        /// Microseconds, with the nanoseconds kept as a fraction
+        auto ns     = e.timestamp_ns - base_ns;
+        auto common = [&](char const* name, char phase) {
+          out << "{\"name\":\"" << name << "\",\"ph\":\"" << phase
+              << "\",\"ts\":" << ns / 1000 << "." << ::std::setw(3)
+              << ::std::setfill('0') << ns % 1000
+              << ",\"pid\":0,\"tid\":" << tid;
+          if ('i' == phase) {
+            out << ",\"s\":\"t\"";
+          }
+        };
+        auto end_resume = [&](char const* result) {
+          common("resume", 'E');
+          out << ",\"args\":{\"result\":\"" << result << "\"";
+        };
+        switch (static_cast< trace_kind >(e.kind)) {
+          case trace_kind::DEQUEUE:
+            common("dequeue", 'i');
+            out << ",\"args\":{\"count\":" << e.arg;
+            break;
+          case trace_kind::NETPOLL:
+            common("netpoll", 'i');
+            out << ",\"args\":{\"count\":" << e.arg;
+            break;
+          case trace_kind::RESUME:
+            common("resume", 'B');
+            out << ",\"args\":{\"resumable\":\"0x" << ::std::hex << e.arg
+                << ::std::dec << "\"";
+            break;
+          case trace_kind::DONE:
+            end_resume("done");
+            break;
+          case trace_kind::RESCHEDULE:
+            end_resume("reschedule");
+            break;
+          case trace_kind::BLOCK_PORT:
+            end_resume("port");
+            out << ",\"fd\":" << e.arg;
+            break;
+          case trace_kind::BLOCK_SLEEP:
+            end_resume("sleep");
+            out << ",\"ns\":" << e.arg;
+            break;
+          case trace_kind::PARK:
+            common("park", 'B');
+            out << ",\"args\":{\"state\":" << e.arg;
+            break;
+          case trace_kind::WAKE:
+            common("park", 'E');
+            out << ",\"args\":{\"events\":" << e.arg;
+            break;
+          case trace_kind::UNPARK:
+            common("unpark", 'i');
+            out << ",\"args\":{\"worker\":" << e.arg;
+            break;
+        }
+        out << "}}";
+      }
+    }
+
+    void write_chrome_trace(::std::ostream& out,
+                            ref< vector< trace_thread > > threads) {
+      /// Timestamps are made relative to the earliest event, the viewers
+      /// lose precision on large ones
+      auto base_ns = numeric_limits< u64 >::max();
+      for (auto&& t : threads) {
+        if (!t.events.empty()) {
+          base_ns = min< u64 >(base_ns, t.events.front().timestamp_ns);
+        }
+      }
+      out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+      auto first = true;
+      for (auto&& t : threads) {
+        if (!first) {
+          out << ",";
+        }
+        first = false;
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":"
+            << t.id << ",\"args\":{\"name\":\"worker " << t.id << "\"}}";
+        for (auto&& e : t.events) {
+          out << ",";
+          write_event(out, t.id, base_ns, e);
+        }
+      }
+      out << "]}\n";
+    }
+  }
+}
+}
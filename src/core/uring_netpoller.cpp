@@ -0,0 +1,403 @@
+#ifdef XI_HAS_IO_URING
+
+#include "xi/core/netpoller.h"
+#include "xi/core/detail/netpoller_impl.h"
+#include "xi/core/resumable.h"
+#include "xi/util/spin_lock.h"
+
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace xi {
+namespace core {
+  namespace v2 {
+    namespace {
+      i32 io_uring_setup(u32 entries, io_uring_params* p) {
+        return ::syscall(__NR_io_uring_setup, entries, p);
+      }
+
+      i32 io_uring_enter(i32 fd, u32 to_submit, u32 min_complete, u32 flags) {
+        return ::syscall(
+            __NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+      }
+
+      template < class T >
+      T* at_offset(void* base, u32 offset) {
+        return reinterpret_cast< T* >(static_cast< u8* >(base) + offset);
+      }
+
+      u32 load_acquire(u32* p) {
+        return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+      }
+
+      void store_release(u32* p, u32 v) {
+        __atomic_store_n(p, v, __ATOMIC_RELEASE);
+      }
+    }
+
+    /// Netpoller on top of io_uring, driven through raw system calls.
+    ///
+    /// Interest is registered as one-shot POLL_ADD submissions, which are
+    /// only queued in the submission ring and handed to the kernel in
+    /// batches whenever the owner polls. Sleepers are woken through an
+    /// eventfd that is kept under a poll of its own, and deadlines are
+    /// absolute TIMEOUT submissions.
+    class uring_netpoller final : public netpoller::impl {
+      i32 _ring      = -1;
+      i32 _wakeup_fd = -1;
+      bool _sq_poll  = false;
+
+      void* _sq_map   = MAP_FAILED;
+      usize _sq_size  = 0;
+      void* _cq_map   = MAP_FAILED;
+      usize _cq_size  = 0;
+      void* _sqe_map  = MAP_FAILED;
+      usize _sqe_size = 0;
+
+      struct {
+        u32* head;
+        u32* tail;
+        u32* flags;
+        u32* array;
+        u32 mask;
+        u32 entries;
+        io_uring_sqe* sqes;
+        /// Tail as seen by us, published on submission
+        u32 local_tail;
+      } _sq;
+
+      struct {
+        u32* head;
+        u32* tail;
+        u32 mask;
+        io_uring_cqe* cqes;
+      } _cq;
+
+      /// Completions may be reaped on our behalf by another thread
+      spin_lock _cq_lock;
+      atomic< usize > _pending{0};
+      /// Set when the poll on the wakeup eventfd needs to be re-armed
+      atomic< bool > _wakeup_armed{false};
+      /// Deadline the timeout is currently armed for, if any
+      steady_clock::time_point _armed = steady_clock::time_point::max();
+      /// Read by the kernel when the timeout is submitted
+      __kernel_timespec _deadline;
+
+    public:
+      ~uring_netpoller();
+      bool setup(ref< netpoller::config >);
+
+      void await_readable(resumable* r, i32 fd) override;
+      void await_writable(resumable* r, i32 fd) override;
+      usize poll_into(mut< worker_queue > queue,
+                      usize n,
+                      bool block,
+                      bool on_behalf) override;
+      usize poll_until(mut< worker_queue > queue,
+                       usize n,
+                       steady_clock::time_point deadline) override;
+      void flush() override;
+      usize pending() const override;
+      i32 native_handle() const override;
+      void unblock_one() override;
+
+    private:
+      io_uring_sqe* _next_sqe();
+      void _poll_add(i32 fd, u32 events, u64 user_data);
+      void _arm_wakeup();
+      void _arm_timer(steady_clock::time_point deadline);
+      void _enter(u32 min_complete);
+      /// Returns the number of completions, rather than of resumables
+      usize _reap(mut< worker_queue >, usize n, bool on_behalf);
+    };
+
+    uring_netpoller::~uring_netpoller() {
+      if (_sqe_map != MAP_FAILED) {
+        ::munmap(_sqe_map, _sqe_size);
+      }
+      if (_cq_map != MAP_FAILED && _cq_map != _sq_map) {
+        ::munmap(_cq_map, _cq_size);
+      }
+      if (_sq_map != MAP_FAILED) {
+        ::munmap(_sq_map, _sq_size);
+      }
+      if (_wakeup_fd != -1) {
+        ::close(_wakeup_fd);
+      }
+      if (_ring != -1) {
+        ::close(_ring);
+      }
+    }
+
+    bool uring_netpoller::setup(ref< netpoller::config > c) {
+      io_uring_params params = {};
+      if (c.sq_poll) {
+        params.flags |= IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = c.sq_poll_idle_ms;
+      }
+      _ring = io_uring_setup(c.queue_depth, &params);
+      if (-1 == _ring) {
+        /// Too old a kernel, or not allowed to use SQPOLL
+        return false;
+      }
+      _sq_poll = c.sq_poll;
+
+      _sq_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+      _cq_size =
+          params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+      if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        _sq_size = _cq_size = max(_sq_size, _cq_size);
+      }
+      _sq_map = ::mmap(nullptr,
+                       _sq_size,
+                       PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE,
+                       _ring,
+                       IORING_OFF_SQ_RING);
+      if (MAP_FAILED == _sq_map) {
+        return false;
+      }
+      if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        _cq_map = _sq_map;
+      } else {
+        _cq_map = ::mmap(nullptr,
+                         _cq_size,
+                         PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE,
+                         _ring,
+                         IORING_OFF_CQ_RING);
+        if (MAP_FAILED == _cq_map) {
+          return false;
+        }
+      }
+      _sqe_size = params.sq_entries * sizeof(io_uring_sqe);
+      _sqe_map  = ::mmap(nullptr,
+                        _sqe_size,
+                        PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE,
+                        _ring,
+                        IORING_OFF_SQES);
+      if (MAP_FAILED == _sqe_map) {
+        return false;
+      }
+
+      _sq.head       = at_offset< u32 >(_sq_map, params.sq_off.head);
+      _sq.tail       = at_offset< u32 >(_sq_map, params.sq_off.tail);
+      _sq.flags      = at_offset< u32 >(_sq_map, params.sq_off.flags);
+      _sq.array      = at_offset< u32 >(_sq_map, params.sq_off.array);
+      _sq.mask       = *at_offset< u32 >(_sq_map, params.sq_off.ring_mask);
+      _sq.entries    = params.sq_entries;
+      _sq.sqes       = static_cast< io_uring_sqe* >(_sqe_map);
+      _sq.local_tail = *_sq.tail;
+
+      _cq.head = at_offset< u32 >(_cq_map, params.cq_off.head);
+      _cq.tail = at_offset< u32 >(_cq_map, params.cq_off.tail);
+      _cq.mask = *at_offset< u32 >(_cq_map, params.cq_off.ring_mask);
+      _cq.cqes = at_offset< io_uring_cqe >(_cq_map, params.cq_off.cqes);
+
+      _wakeup_fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+      if (-1 == _wakeup_fd) {
+        return false;
+      }
+      _arm_wakeup();
+      _enter(0);
+      return true;
+    }
+
+    void uring_netpoller::await_readable(resumable* r, i32 fd) {
+      _poll_add(fd, POLLIN, reinterpret_cast< u64 >(r));
+      _pending.fetch_add(1, memory_order_relaxed);
+    }
+
+    void uring_netpoller::await_writable(resumable* r, i32 fd) {
+      _poll_add(fd, POLLOUT, reinterpret_cast< u64 >(r));
+      _pending.fetch_add(1, memory_order_relaxed);
+    }
+
+    usize uring_netpoller::poll_into(mut< worker_queue > q,
+                                     usize n,
+                                     bool block,
+                                     bool on_behalf) {
+      auto before = q->size();
+      if (on_behalf) {
+        /// The submission ring belongs to the owner, only reap what is
+        /// already there. Our watch is edge triggered, so all of it.
+        while (n > 0 && _reap(q, n, true) == n) {
+        }
+        return q->size() - before;
+      }
+      if (!_wakeup_armed.load(memory_order_acquire)) {
+        _arm_wakeup();
+      }
+      auto cnt = _reap(q, n, false);
+      /// Only wait for completions if there are none yet
+      _enter(block && 0 == cnt ? 1 : 0);
+      if (0 == cnt) {
+        _reap(q, n, false);
+      }
+      return q->size() - before;
+    }
+
+    usize uring_netpoller::poll_until(mut< worker_queue > q,
+                                      usize n,
+                                      steady_clock::time_point deadline) {
+      _arm_timer(deadline);
+      return poll_into(q, n, true, false);
+    }
+
+    void uring_netpoller::flush() {
+      _enter(0);
+    }
+
+    usize uring_netpoller::pending() const {
+      return _pending.load(memory_order_relaxed);
+    }
+
+    i32 uring_netpoller::native_handle() const {
+      return _ring;
+    }
+
+    void uring_netpoller::unblock_one() {
+      ::eventfd_write(_wakeup_fd, 1);
+    }
+
+    io_uring_sqe* uring_netpoller::_next_sqe() {
+      while (_sq.local_tail - load_acquire(_sq.head) >= _sq.entries) {
+        /// Ring is full, hand what we have over to the kernel
+        _enter(0);
+      }
+      auto idx = _sq.local_tail & _sq.mask;
+      auto sqe = &_sq.sqes[idx];
+      ::memset(sqe, 0, sizeof(*sqe));
+      _sq.array[idx] = idx;
+      ++_sq.local_tail;
+      return sqe;
+    }
+
+    void uring_netpoller::_poll_add(i32 fd, u32 events, u64 user_data) {
+      auto sqe         = _next_sqe();
+      sqe->opcode      = IORING_OP_POLL_ADD;
+      sqe->fd          = fd;
+      sqe->poll_events = events;
+      sqe->user_data   = user_data;
+    }
+
+    void uring_netpoller::_arm_wakeup() {
+      _wakeup_armed.store(true, memory_order_release);
+      _poll_add(_wakeup_fd, POLLIN, reinterpret_cast< u64 >(&_wakeup_fd));
+    }
+
+    void uring_netpoller::_arm_timer(steady_clock::time_point deadline) {
+      if (deadline == _armed) {
+        return;
+      }
+      if (_armed != steady_clock::time_point::max()) {
+        auto sqe       = _next_sqe();
+        sqe->opcode    = IORING_OP_TIMEOUT_REMOVE;
+        sqe->fd        = -1;
+        sqe->addr      = reinterpret_cast< u64 >(&_deadline);
+        sqe->user_data = reinterpret_cast< u64 >(&_armed);
+      }
+      if (deadline != steady_clock::time_point::max()) {
+        auto ns = duration_cast< nanoseconds >(deadline.time_since_epoch());
+        _deadline.tv_sec  = ns.count() / 1'000'000'000;
+        _deadline.tv_nsec = ns.count() % 1'000'000'000;
+
+        auto sqe           = _next_sqe();
+        sqe->opcode        = IORING_OP_TIMEOUT;
+        sqe->fd            = -1;
+        sqe->addr          = reinterpret_cast< u64 >(&_deadline);
+        sqe->len           = 1;
+        sqe->off           = 0;
+        sqe->timeout_flags = IORING_TIMEOUT_ABS;
+        sqe->user_data     = reinterpret_cast< u64 >(&_deadline);
+      }
+      _armed = deadline;
+    }
+
+    /// Publishes queued submissions and optionally waits for completions.
+    /// With SQPOLL the kernel picks submissions up by itself, and only
+    /// needs a nudge once its thread went to sleep.
+    void uring_netpoller::_enter(u32 min_complete) {
+      store_release(_sq.tail, _sq.local_tail);
+      u32 flags     = min_complete ? IORING_ENTER_GETEVENTS : 0;
+      u32 to_submit = _sq.local_tail - load_acquire(_sq.head);
+      if (_sq_poll) {
+        atomic_thread_fence(memory_order_seq_cst);
+        if (__atomic_load_n(_sq.flags, __ATOMIC_RELAXED) &
+            IORING_SQ_NEED_WAKEUP) {
+          flags |= IORING_ENTER_SQ_WAKEUP;
+        } else if (!min_complete) {
+          return;
+        }
+      } else if (!to_submit && !min_complete) {
+        return;
+      }
+      auto ret = io_uring_enter(_ring, to_submit, min_complete, flags);
+      if (-1 == ret && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        ::perror("io_uring_enter");
+        ::exit(EXIT_FAILURE); // FIXME
+      }
+    }
+
+    usize uring_netpoller::_reap(mut< worker_queue > q,
+                                 usize n,
+                                 bool on_behalf) {
+      if (on_behalf) {
+        if (!_cq_lock.try_lock()) {
+          return 0;
+        }
+      } else {
+        _cq_lock.lock();
+      }
+      XI_SCOPE(exit) {
+        _cq_lock.unlock();
+      };
+      auto head = *_cq.head;
+      auto tail = load_acquire(_cq.tail);
+      usize cnt = 0;
+      for (; head != tail && cnt < n; ++head, ++cnt) {
+        auto&& cqe     = _cq.cqes[head & _cq.mask];
+        auto user_data = cqe.user_data;
+        if (XI_UNLIKELY(user_data == reinterpret_cast< u64 >(&_wakeup_fd))) {
+          if (!on_behalf) {
+            u64 val;
+            ::eventfd_read(_wakeup_fd, &val);
+          }
+          _wakeup_armed.store(false, memory_order_release);
+          continue;
+        }
+        if (XI_UNLIKELY(user_data == reinterpret_cast< u64 >(&_deadline))) {
+          if (!on_behalf && -ETIME == cqe.res) {
+            _armed = steady_clock::time_point::max();
+          }
+          continue;
+        }
+        if (XI_UNLIKELY(user_data == reinterpret_cast< u64 >(&_armed))) {
+          continue;
+        }
+        auto r = reinterpret_cast< resumable* >(user_data);
+        q->enqueue(own< resumable >{r});
+        _pending.fetch_sub(1, memory_order_relaxed);
+      }
+      store_release(_cq.head, head);
+      return cnt;
+    }
+
+    shared_ptr< netpoller::impl > make_uring_netpoller(
+        ref< netpoller::config > c) {
+      auto poller = make_shared< uring_netpoller >();
+      if (!poller->setup(c)) {
+        return nullptr;
+      }
+      return poller;
+    }
+  }
+}
+}
+
+#endif // XI_HAS_IO_URING
@@ -9,14 +9,24 @@ namespace xi {
 namespace core {
   namespace v2 {
     enum {
-      DEFAULT_NETPOLL_MAX                = numeric_limits< usize >::max(),
-      DEFAULT_SCHEDULER_DEQUEUE_MAX      = 100,
-      DEFAULT_LOOP_BUDGET_ALLOCATION     = 1'000'000,
-      DEFAULT_MAX_LOOP_BUDGET_ALLOCATION = 5'000'000,
-      DEFAULT_ISOL_BUDGET_ALLOCATION     = 10'000'000,
-      DEFAULT_SPINS_BEFORE_IDLE          = 1000,
-      UPPER_BOUND_READY_QUEUE_NS         = 5'000'0,
-      UPPER_BOUND_FAST_QUEUE_NS          = 100'000'000,
+      DEFAULT_NETPOLL_MAX                   = numeric_limits< usize >::max(),
+      DEFAULT_SCHEDULER_DEQUEUE_MAX         = 100,
+      DEFAULT_LOOP_BUDGET_ALLOCATION_NS     = 300'000,
+      DEFAULT_MAX_LOOP_BUDGET_ALLOCATION_NS = 1'500'000,
+      DEFAULT_ISOL_BUDGET_ALLOCATION_NS     = 3'000'000,
+      DEFAULT_SPINS_BEFORE_IDLE             = 100,
+      DEFAULT_SPIN_GAP_MULTIPLIER           = 2,
+      DEFAULT_MAX_SPIN_WINDOW_NS            = 200'000,
+      DEFAULT_MAX_SPIN_BURN_RATIO           = 102,
+      DEFAULT_STEALABLE_THRESHOLD           = 16,
+      DEFAULT_STEAL_BATCH_MAX               = 32,
+      DEFAULT_LOAD_REPORT_INTERVAL_NS       = 3'000'000,
+      DEFAULT_CLOCK_RESYNC_INTERVAL_NS      = 1'000'000,
+      UPPER_BOUND_READY_QUEUE_NS            = 5'000'0,
+      UPPER_BOUND_FAST_QUEUE_NS             = 100'000'000,
+      DEFAULT_LATENCY_CRITICAL_WEIGHT       = 6,
+      DEFAULT_NORMAL_WEIGHT                 = 3,
+      DEFAULT_BACKGROUND_WEIGHT             = 1,
     };
 
     thread_local mut< worker > LOCAL_WORKER = nullptr;
@@ -25,20 +35,43 @@ namespace core {
         DEFAULT_NETPOLL_MAX,
         // usize scheduler_dequeue_max;
         DEFAULT_SCHEDULER_DEQUEUE_MAX,
-        // usize loop_budget_allocation;
-        DEFAULT_LOOP_BUDGET_ALLOCATION,
-        // usize max_loop_budget_allocation;
-        DEFAULT_MAX_LOOP_BUDGET_ALLOCATION,
-        // usize isolation_budget_allocation;
-        DEFAULT_ISOL_BUDGET_ALLOCATION,
+        // nanoseconds loop_budget_allocation;
+        nanoseconds(DEFAULT_LOOP_BUDGET_ALLOCATION_NS),
+        // nanoseconds max_loop_budget_allocation;
+        nanoseconds(DEFAULT_MAX_LOOP_BUDGET_ALLOCATION_NS),
+        // nanoseconds isolation_budget_allocation;
+        nanoseconds(DEFAULT_ISOL_BUDGET_ALLOCATION_NS),
         // usize nr_spins_before_idle;
         DEFAULT_SPINS_BEFORE_IDLE,
+        // usize stealable_threshold;
+        DEFAULT_STEALABLE_THRESHOLD,
+        // usize steal_batch_max;
+        DEFAULT_STEAL_BATCH_MAX,
+        // nanoseconds load_report_interval;
+        nanoseconds(DEFAULT_LOAD_REPORT_INTERVAL_NS),
+        // nanoseconds clock_resync_interval;
+        nanoseconds(DEFAULT_CLOCK_RESYNC_INTERVAL_NS),
         // timer_bounds;
         {
             // nanoseconds upper_bound_ready_queue;
             nanoseconds(UPPER_BOUND_READY_QUEUE_NS),
             // nanoseconds upper_bound_fast_queue;
             nanoseconds(UPPER_BOUND_FAST_QUEUE_NS),
+        },
+        // array< u32, SCHEDULING_GROUPS > group_weights;
+        {{
+            DEFAULT_LATENCY_CRITICAL_WEIGHT,
+            DEFAULT_NORMAL_WEIGHT,
+            DEFAULT_BACKGROUND_WEIGHT,
+        }},
+        // spin_policy::config spin;
+        {
+            // u32 gap_multiplier;
+            DEFAULT_SPIN_GAP_MULTIPLIER,
+            // nanoseconds max_window;
+            nanoseconds(DEFAULT_MAX_SPIN_WINDOW_NS),
+            // u32 max_burn_ratio;
+            DEFAULT_MAX_SPIN_BURN_RATIO,
         }};
 
     worker::worker(mut< netpoller > n,
@@ -50,28 +83,47 @@ namespace core {
         , _scheduler_queue(sq)
         , _scheduler(s)
         , _index(i)
-        , _config(move(c)) {
+        , _config(move(c))
+        , _clock(_config.clock_resync_interval)
+        , _spin(_config.spin) {
     }
 
     void worker::run() {
-      usize loop_budget_allocation = _config.loop_budget_allocation;
-      u64 spins                    = 0;
+      auto loop_budget_allocation = _config.loop_budget_allocation;
+      u64 spins                   = 0;
+      /// The first window starts now, not at the epoch of the clock
+      _load_window_start = hw::monotonic_ns();
     central_schedule:
       for (;;) {
+        /// Pick up events on ports of parked workers
+        _scheduler->central_poll();
+
         auto cnt = _scheduler_queue->dequeue_into(
             edit(_ready_queue), _config.scheduler_dequeue_max);
+        if (cnt) {
+          XI_TRACE(_trace, DEQUEUE, cnt);
+          _note_arrival();
+        }
 
         /// Decide whether to report as idle to scheduler
+        /// Pending sleepers don't keep the worker from going idle, the
+        /// scheduler parks it until the earliest of them is due.
         if (!cnt // scheduler queue has nothing
             &&
-            _local_sleep_queue.is_empty() // short sleep queue has nothing
+            !_has_ready() // nothing woke up in the meantime
             &&
-            ++spins > _config.nr_spins_before_idle // spun for enough rounds
+            _steal_queue.is_empty() // nothing left unclaimed by others
             ) {
-          /// Report as idle. Scheduler will block until it has more work.
-          spins = 0;
-          _scheduler->idle_worker(this);
-          goto central_schedule;
+          if (_should_idle(++spins)) { // spun for long enough
+            /// Report as idle. Scheduler will block until it has more
+            /// work.
+            spins = 0;
+            _end_spin(hw::monotonic_ns(), false);
+            _scheduler->idle_worker(this);
+            goto central_schedule;
+          }
+        } else if (_spin.is_spinning()) {
+          _end_spin(hw::monotonic_ns(), true);
         }
         /// This budget governs how long a worker can stay inside the hot
         /// loop without going to scheduler for external work
@@ -79,18 +131,32 @@ namespace core {
       poll:
         for (; isol_budget.adjust_spent();) {
           /// Get work from netpoller
-          _netpoller->poll_into(edit(_port_queue), _config.netpoll_max);
+          auto arrived =
+              _netpoller->poll_into(edit(_port_queue), _config.netpoll_max);
+          if (arrived) {
+            XI_TRACE(_trace, NETPOLL, arrived);
+            _note_arrival();
+          }
 
           /// Check short sleep queue for expired items
           _local_sleep_queue.dequeue_into(edit(_ready_queue),
-                                          steady_clock::now());
+                                          _clock.refresh());
+
+          /// Redistribute long sleepers that have woken up
+          _scheduler->central_wakeup(_clock.now());
+
+          /// Let idle workers take what we won't get to soon
+          _publish_surplus();
+          _load.queue_depth.store(_ready_count() + _port_queue.size() +
+                                      _steal_queue.size(),
+                                  memory_order_relaxed);
 
           /// This budget governs how long a worker can be processing
           /// ready event without getting work from netpoller
           execution_budget loop_budget(loop_budget_allocation);
 
           /// Reset spin count if there's work to be done
-          if (!_port_queue.is_empty() || !_ready_queue.is_empty()) {
+          if (!_port_queue.is_empty() || _has_ready()) {
             spins = 0;
           }
 
@@ -100,23 +166,31 @@ namespace core {
             spins = 0;
             _run_task_from_queue(edit(_port_queue), edit(loop_budget));
             if (XI_UNLIKELY(!loop_budget.adjust_spent())) {
+              _report_load(loop_budget.spent());
               goto poll;
             }
           }
 
+          /// Take back whatever was published but not stolen
+          if (!_has_ready()) {
+            _reclaim_published();
+          }
+
           /// Non-ports are given lower priority (even at the same priority
           /// level) to reduce externally observable latency.
-          while (!_ready_queue.is_empty()) {
-            _run_task_from_queue(edit(_ready_queue), edit(loop_budget));
-            if (XI_UNLIKELY(!loop_budget.adjust_spent())) {
-              goto poll;
-            }
+          _sort_ready();
+          if (XI_UNLIKELY(
+                  !_run_groups(edit(loop_budget), loop_budget_allocation))) {
+            _report_load(loop_budget.spent());
+            goto poll;
           }
 
+          _report_load(loop_budget.spent());
+
           /// Carry over unspent budget into the next round
           if (!loop_budget.is_expended()) {
             loop_budget_allocation =
-                max(_config.max_loop_budget_allocation,
+                min(_config.max_loop_budget_allocation,
                     loop_budget_allocation + loop_budget.remainder());
             goto central_schedule;
           }
@@ -129,19 +203,190 @@ namespace core {
       if (ns < _config.timer_bounds.upper_bound_ready_queue) {
         return _ready_queue.enqueue(move(r));
       }
-      // TODO: add support for long queues
-      // if (ns > _config.timer_bounds.upper_bound_fast_queue) {
-      //   return _scheduler->central_sleep(move(r), steady_clock::now() + ns);
-      // }
-      return _local_sleep_queue.enqueue(steady_clock::now() + ns, move(r));
+      auto now = _clock.refresh();
+      if (ns > _config.timer_bounds.upper_bound_fast_queue) {
+        return _scheduler->central_sleep(move(r), now + ns);
+      }
+      return _local_sleep_queue.enqueue(now + ns, move(r));
+    }
+
+    void worker::_report_load(nanoseconds busy) {
+      _load_window_busy += busy;
+      auto now     = hw::monotonic_ns();
+      auto elapsed = nanoseconds(now - _load_window_start);
+      if (elapsed < _config.load_report_interval) {
+        return;
+      }
+      auto ratio = min< usize >(
+          1024, (_load_window_busy.count() << 10) / elapsed.count());
+      auto prev  = _load.busy_ratio.load(memory_order_relaxed);
+      _load.busy_ratio.store((prev * 3 + ratio) / 4, memory_order_relaxed);
+      _spin.end_interval(elapsed);
+      _load_window_start = now;
+      _load_window_busy  = nanoseconds(0);
+      _scheduler->review_workers();
+    }
+
+    /// External work showed up, either from the scheduler or on a port
+    void worker::_note_arrival() {
+      auto now = hw::monotonic_ns();
+      _spin.note_arrival(now);
+      if (_spin.is_spinning()) {
+        _end_spin(now, true);
+      }
+    }
+
+    bool worker::_should_idle(u64 spins) {
+      if (spins <= _config.nr_spins_before_idle) {
+        return false;
+      }
+      return _spin.should_idle(hw::monotonic_ns());
+    }
+
+    void worker::_end_spin(u64 now_ns, bool found_work) {
+      _stats.record_spin(_spin.end_spin(now_ns), found_work);
+    }
+
+    bool worker::_has_ready() const {
+      if (!_ready_queue.is_empty()) {
+        return true;
+      }
+      for (auto&& q : _group_queues) {
+        if (!q.is_empty()) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    usize worker::_ready_count() const {
+      auto count = _ready_queue.size();
+      for (auto&& q : _group_queues) {
+        count += q.size();
+      }
+      return count;
+    }
+
+    void worker::_sort_ready() {
+      for (;;) {
+        auto r = _ready_queue.dequeue();
+        if (r.is_none()) {
+          return;
+        }
+        auto ready = r.unwrap();
+        auto group = index_of(ready->group());
+        _group_queues[group].enqueue(move(ready));
+      }
+    }
+
+    /// Every group first gets its share of the allocation, then whatever
+    /// is left of the budget goes to the groups in order of priority.
+    /// Resumables made ready meanwhile wait for the next round. Returns
+    /// false if the budget ran out.
+    bool worker::_run_groups(mut< execution_budget > budget,
+                             nanoseconds allocation) {
+      u64 total_weight = 0;
+      for (auto w : _config.group_weights) {
+        total_weight += w;
+      }
+      for (auto pass : {0, 1}) {
+        for (auto g : range::to< usize >(SCHEDULING_GROUPS)) {
+          auto&& q   = _group_queues[g];
+          auto share = nanoseconds::zero();
+          /// Without any weights, groups only run in order of priority
+          if (total_weight > 0) {
+            share = allocation * _config.group_weights[g] / total_weight;
+          }
+          auto limit = budget->spent() + share;
+          while (!q.is_empty() && (pass || budget->spent() < limit)) {
+            _run_task_from_queue(edit(q), budget);
+            if (XI_UNLIKELY(!budget->adjust_spent())) {
+              return false;
+            }
+          }
+        }
+      }
+      return true;
+    }
+
+    void worker::_publish_surplus() {
+      auto depth = _ready_count();
+      if (depth <= _config.stealable_threshold) {
+        return;
+      }
+      auto was_empty = _steal_queue.is_empty();
+      auto surplus   = min< usize >(depth - _config.stealable_threshold,
+                                  steal_queue::CAPACITY - _steal_queue.size());
+      /// Surplus is taken from the back, least urgent work first, and
+      /// published in the original order, so that thieves take the
+      /// oldest of it first
+      array< mut< worker_queue >, SCHEDULING_GROUPS + 1 > by_urgency = {{
+          edit(_group_queues[index_of(scheduling_group::BACKGROUND)]),
+          edit(_ready_queue),
+          edit(_group_queues[index_of(scheduling_group::NORMAL)]),
+          edit(_group_queues[index_of(scheduling_group::LATENCY_CRITICAL)]),
+      }};
+      static_vector< own< resumable >, steal_queue::CAPACITY > tail;
+      for (auto q : by_urgency) {
+        while (tail.size() < surplus && !q->is_empty()) {
+          tail.emplace_back(q->dequeue_back().unwrap());
+        }
+      }
+      for (auto&& r : adaptors::reverse(tail)) {
+        _steal_queue.push(move(r));
+      }
+      if (was_empty && !_steal_queue.is_empty()) {
+        _scheduler->work_available();
+      }
+    }
+
+    void worker::evacuate(mut< worker_queue > q) {
+      _scheduler_queue->dequeue_into(q, numeric_limits< usize >::max());
+      q->splice(edit(_port_queue));
+      for (auto&& g : _group_queues) {
+        q->splice(edit(g));
+      }
+      q->splice(edit(_ready_queue));
+      /// Thieves may still be taking from it
+      while (!_steal_queue.is_empty()) {
+        auto r = _steal_queue.steal();
+        if (r.is_some()) {
+          q->enqueue(r.unwrap());
+        }
+      }
+      _local_sleep_queue.drain([this](own< resumable > r) {
+        auto when = r->wakeup_time();
+        _scheduler->central_sleep(move(r), when);
+      });
+      _load.queue_depth.store(0, memory_order_relaxed);
+      _load.busy_ratio.store(0, memory_order_relaxed);
+    }
+
+    void worker::_reclaim_published() {
+      for ([[gnu::unused]] auto i : range::to(_config.stealable_threshold)) {
+        auto r = _steal_queue.steal();
+        if (r.is_none()) {
+          return;
+        }
+        _ready_queue.enqueue(r.unwrap());
+      }
     }
 
     void worker::_run_task_from_queue(mut< worker_queue > q,
                                       mut< execution_budget > budget) {
       _current_task = q->dequeue().unwrap();
 
-      auto r_start = high_resolution_clock::now();
-      auto result  = _current_task->resume(budget);
+      auto start = hw::monotonic_ns();
+      /// Port resumables are stamped when their event is polled
+      auto&& wait = (q == edit(_port_queue)) ? _stats.poll_to_dispatch
+                                             : _stats.queue_wait;
+      wait.record(nanoseconds(start - _current_task->ready_since()));
+      _current_task->ready_since(0);
+
+      XI_TRACE(_trace, RESUME, reinterpret_cast< u64 >(_current_task.get()));
+      auto result = _current_task->resume(budget);
+      _stats.record_run(_current_task->group(),
+                        nanoseconds(hw::monotonic_ns() - start));
       struct match : resumable::match {
         mutable mut< worker > _worker;
         mutable own< resumable > _resumable;
@@ -151,14 +396,18 @@ namespace core {
         }
 
         void operator()(resumable::done) const {
+          XI_TRACE(_worker->_trace, DONE, 0);
         }
         void operator()(resumable::reschedule) const {
+          XI_TRACE(_worker->_trace, RESCHEDULE, 0);
           _worker->_ready_queue.enqueue(move(_resumable));
         }
         void operator()(resumable::blocked::sleep sleep) const {
+          XI_TRACE(_worker->_trace, BLOCK_SLEEP, sleep.duration.count());
           _worker->_block_resumable_on_sleep(move(_resumable), sleep.duration);
         }
         void operator()(resumable::blocked::port port) const {
+          XI_TRACE(_worker->_trace, BLOCK_PORT, port.fd);
           switch (port.type) {
             case resumable::blocked::port::READ:
               return _worker->_netpoller->await_readable(port.fd,
@@ -171,8 +420,6 @@ namespace core {
       };
 
       apply_visitor(match{this, move(_current_task)}, result);
-      RESUMABLE_STAT.running += high_resolution_clock::now() - r_start;
-      ++RESUMABLE_STAT.running_count;
     }
   }
 }
@@ -1,6 +1,10 @@
 #include "xi/ext/configure.h"
 #include "xi/hw/hardware.h"
 
+#if defined(XI_HAS_NUMA)
+#include <numa.h>
+#endif
+
 namespace xi {
 namespace hw {
 
@@ -35,7 +39,18 @@ namespace hw {
 
 #else // XI_HAS_HWLOC
 
-  cpu::cpu(unsigned core) : _id{core, core} {
+  namespace {
+    unsigned numa_node_of(unsigned core) {
+#ifdef XI_HAS_NUMA
+      if (::numa_available() >= 0) {
+        return max(::numa_node_of_cpu(core), 0);
+      }
+#endif // XI_HAS_NUMA
+      return 0;
+    }
+  }
+
+  cpu::cpu(unsigned core) : _id{core, numa_node_of(core)} {
   }
 
   machine::machine() {
@@ -50,5 +65,24 @@ namespace hw {
   }
 
 #endif // XI_HAS_HWLOC
+
+  unsigned numa_nodes() {
+#ifdef XI_HAS_NUMA
+    if (::numa_available() >= 0) {
+      return max(::numa_max_node() + 1, 1);
+    }
+#endif // XI_HAS_NUMA
+    return 1;
+  }
+
+  void prefer_numa_node(unsigned node) {
+#ifdef XI_HAS_NUMA
+    if (::numa_available() >= 0) {
+      ::numa_set_preferred(node);
+    }
+#else
+    (void)node;
+#endif // XI_HAS_NUMA
+  }
 }
 }
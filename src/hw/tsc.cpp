@@ -0,0 +1,95 @@
+#include "xi/hw/tsc.h"
+
+#include <cpuid.h>
+#include <time.h>
+
+namespace xi {
+namespace hw {
+  namespace {
+    enum : u64 { NANOSECONDS_PER_SECOND = 1'000'000'000 };
+
+    u64 clock_ns() {
+      timespec ts;
+      ::clock_gettime(CLOCK_MONOTONIC, &ts);
+      return static_cast< u64 >(ts.tv_sec) * NANOSECONDS_PER_SECOND +
+             ts.tv_nsec;
+    }
+
+    /// Reads both clocks as close together as possible, retrying when
+    /// the clock read took long enough to have been interrupted
+    pair< u64, u64 > read_pair() {
+      auto best = numeric_limits< u64 >::max();
+      pair< u64, u64 > result;
+      for ([[gnu::unused]] auto i : range::to(5)) {
+        auto before = read_tsc();
+        auto ns     = clock_ns();
+        auto after  = read_tsc();
+        if (after - before < best) {
+          best   = after - before;
+          result = make_pair(before + (after - before) / 2, ns);
+        }
+      }
+      return result;
+    }
+
+    /// Crystal clock based frequency from cpuid 0x15, if reported
+    u64 cpuid_tsc_frequency() {
+      unsigned max_leaf = __get_cpuid_max(0, nullptr);
+      if (max_leaf < 0x15) {
+        return 0;
+      }
+      unsigned denominator, numerator, crystal_hz, edx;
+      __cpuid(0x15, denominator, numerator, crystal_hz, edx);
+      if (!denominator || !numerator || !crystal_hz) {
+        return 0;
+      }
+      return static_cast< u64 >(crystal_hz) * numerator / denominator;
+    }
+
+    /// Measures the frequency against CLOCK_MONOTONIC
+    u64 measured_tsc_frequency() {
+      enum : u64 { SAMPLE_NS = 10'000'000 };
+      auto start = read_pair();
+      auto end   = start;
+      do {
+        end = read_pair();
+      } while (end.second - start.second < SAMPLE_NS);
+      return static_cast< u64 >(
+          static_cast< unsigned __int128 >(end.first - start.first) *
+          NANOSECONDS_PER_SECOND / (end.second - start.second));
+    }
+  }
+
+  bool has_invariant_tsc() {
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) ||
+        eax < 0x80000007) {
+      return false;
+    }
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return edx & (1u << 8);
+  }
+
+  tsc_calibration calibrate_tsc() {
+    tsc_calibration c = {};
+    c.invariant       = has_invariant_tsc();
+    if (!c.invariant) {
+      return c;
+    }
+    c.ticks_per_second = cpuid_tsc_frequency();
+    if (!c.ticks_per_second) {
+      c.ticks_per_second = measured_tsc_frequency();
+    }
+    if (!c.ticks_per_second) {
+      c.invariant = false;
+      return c;
+    }
+    c.mult = static_cast< u64 >(
+        (static_cast< unsigned __int128 >(NANOSECONDS_PER_SECOND)
+         << tsc_calibration::SHIFT) /
+        c.ticks_per_second);
+    tie(c.base_tsc, c.base_ns) = read_pair();
+    return c;
+  }
+}
+}
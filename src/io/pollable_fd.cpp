@@ -1,5 +1,6 @@
 #include "xi/io/pollable_fd.h"
 #include "xi/core/all.h"
+#include "xi/core/netpoller.h"
 
 namespace xi {
 namespace io {
@@ -12,6 +13,7 @@ namespace io {
 
   port::~port() {
     if (-1 != _fd) {
+      xi::core::v2::netpoller::forget(_fd);
       close(_fd);
     }
   }
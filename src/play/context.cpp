@@ -220,21 +220,6 @@ protected:
         }
       }
       // {
-      //   auto& stat = core::v2::RESUMABLE_STAT;
-      //   if (0 < stat.running_count) {
-      //     printf("%p resumable\nrunning: %luns\n",
-      //            pthread_self(),
-      //            (stat.running.count() / stat.running_count));
-      //   }
-      //   if (0 < stat.polling_count) {
-      //     printf("%p resumable\npolling: %luns\n",
-      //            pthread_self(),
-      //            (stat.polling.count() / stat.polling_count));
-      //     stat.polling_count = 0;
-      //     stat.polling       = 0ns;
-      //   }
-      // }
-      // {
       //   auto& stat = CHANNEL2_STAT;
       //   if (0 < stat.count) {
       //     printf("%p\nin read: %luns\nin write: %luns\nread write: %luns\n",
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "xi/ext/configure.h"
+
+namespace xi {
+namespace core {
+  namespace v2 {
+
+    /// Placement hint, used by the scheduler to keep related work on
+    /// the same worker (or at least on the same NUMA node).
+    struct affinity {
+      enum kind_t : u8 {
+        ANY,
+        WORKER,
+        NUMA_NODE,
+        KEY,
+      };
+
+      kind_t kind = ANY;
+      u64 value   = 0;
+
+      static affinity any();
+      /// Pin to the worker with the given index
+      static affinity worker(u16);
+      /// Any worker running on the given NUMA node
+      static affinity numa_node(u16);
+      /// Same key always maps to the same worker, e.g. a connection id,
+      /// as long as the set of admitted workers doesn't change. Retiring
+      /// or readmitting a worker remaps keys.
+      static affinity key(u64);
+    };
+
+    inline affinity affinity::any() {
+      return affinity{};
+    }
+
+    inline affinity affinity::worker(u16 index) {
+      return affinity{WORKER, index};
+    }
+
+    inline affinity affinity::numa_node(u16 node) {
+      return affinity{NUMA_NODE, node};
+    }
+
+    inline affinity affinity::key(u64 k) {
+      return affinity{KEY, k};
+    }
+  }
+}
+}
@@ -2,6 +2,7 @@
 
 #include "xi/core/channel.h"
 #include "xi/core/coordinator.h"
+#include "xi/core/coroutine_resumable.h"
 #include "xi/core/generic_resumable.h"
 #include "xi/core/policy/all.h"
 #include "xi/core/reactor/all.h"
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "xi/ext/configure.h"
+#include "xi/core/execution_budget.h"
+
+namespace xi {
+namespace core {
+  namespace v2 {
+
+    /// A steady_clock reading that is cheap to refresh. With an invariant
+    /// TSC the time is interpolated from the TSC, and steady_clock is only
+    /// read again once the resync interval has passed, to stay aligned
+    /// with it. Without one every refresh reads steady_clock.
+    class cached_clock {
+      nanoseconds _resync_interval;
+      u64 _last_tsc;
+      steady_clock::time_point _synced;
+      steady_clock::time_point _now;
+
+    public:
+      explicit cached_clock(nanoseconds resync_interval);
+
+      steady_clock::time_point now() const;
+      steady_clock::time_point refresh();
+    };
+
+    inline cached_clock::cached_clock(nanoseconds resync_interval)
+        : _resync_interval(resync_interval)
+        , _last_tsc(read_tsc())
+        , _synced(steady_clock::now())
+        , _now(_synced) {
+    }
+
+    inline steady_clock::time_point cached_clock::now() const {
+      return _now;
+    }
+
+    inline steady_clock::time_point cached_clock::refresh() {
+      auto&& calibration = hw::tsc();
+      if (XI_UNLIKELY(!calibration.invariant)) {
+        return _now = steady_clock::now();
+      }
+      auto tsc     = read_tsc();
+      auto elapsed = nanoseconds(calibration.ticks_to_ns(tsc - _last_tsc));
+      if (elapsed >= _resync_interval) {
+        _last_tsc = tsc;
+        _synced   = steady_clock::now();
+        return _now = _synced;
+      }
+      return _now = _synced + elapsed;
+    }
+  }
+}
+}
@@ -50,10 +50,11 @@ namespace core {
     vector< thread > _threads;
     unique_ptr<barrier> _barrier;
 
+    /// More workers than cores share them
     static void pin(u8 cpu) {
       cpu_set_t cs;
       CPU_ZERO(&cs);
-      CPU_SET(cpu, &cs);
+      CPU_SET(cpu % max(thread::hardware_concurrency(), 1u), &cs);
       auto r = pthread_setaffinity_np(pthread_self(), sizeof(cs), &cs);
       assert(r == 0);
     }
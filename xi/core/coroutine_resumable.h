@@ -0,0 +1,242 @@
+#pragma once
+
+#include "xi/ext/configure.h"
+#include "xi/core/resumable.h"
+#include "xi/core/runtime.h"
+
+/// Stackless resumables need compiler support for C++20 coroutines, the
+/// rest of the tree still builds without it.
+#if defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+
+namespace xi {
+namespace core {
+  namespace v2 {
+
+    /// Return type of coroutines run by a coroutine_resumable.
+    ///
+    /// The coroutine starts suspended and runs whenever its resumable is
+    /// resumed. Awaiting one of the awaitables below suspends it and
+    /// hands the matching result to the worker, which blocks it exactly
+    /// as it would block a generic_resumable.
+    class task {
+    public:
+      struct promise_type {
+        resumable::result suspended_with = resumable::reschedule{};
+        mut< execution_budget > budget   = nullptr;
+        /// Checked before each resume, the coroutine stays suspended
+        /// until it returns true
+        bool (*resume_when)(void const*) = nullptr;
+        void const* resume_when_arg      = nullptr;
+
+        /// Not an aggregate, or it would be initialized from the
+        /// arguments of the coroutine
+        promise_type() = default;
+
+        task get_return_object();
+        ::std::suspend_always initial_suspend() noexcept;
+        ::std::suspend_always final_suspend() noexcept;
+        void return_void();
+        void unhandled_exception();
+      };
+      using handle_type = ::std::coroutine_handle< promise_type >;
+
+    private:
+      handle_type _handle;
+
+      explicit task(handle_type);
+
+    public:
+      task(task&&);
+      task& operator=(task&&);
+      ~task();
+
+      handle_type handle() const;
+    };
+
+    /// Runs a coroutine in place of a stack. Costs the coroutine frame,
+    /// usually a few hundred bytes, instead of an execution context and
+    /// a full stack.
+    class coroutine_resumable final : public resumable {
+      task _task;
+
+    public:
+      explicit coroutine_resumable(task);
+
+      result resume(mut< execution_budget >) override;
+      /// Coroutines can only suspend at a co_await, calling the blocking
+      /// runtime functions from one is a bug
+      void yield(result) override;
+    };
+
+    namespace detail {
+      /// Suspends with a fixed result
+      struct suspend_with {
+        resumable::result result;
+
+        bool await_ready() const noexcept {
+          return false;
+        }
+        void await_suspend(task::handle_type h) const noexcept {
+          h.promise().suspended_with = result;
+        }
+        void await_resume() const noexcept {
+        }
+      };
+
+      /// Polls a future, or anything else with is_ready(), once per
+      /// resume until it is ready
+      template < class F >
+      struct until_ready {
+        mut< F > future;
+
+        bool await_ready() const {
+          return future->is_ready();
+        }
+        void await_suspend(task::handle_type h) const noexcept {
+          auto&& p          = h.promise();
+          p.suspended_with  = resumable::reschedule{};
+          p.resume_when     = [](void const* f) {
+            return static_cast< F const* >(f)->is_ready();
+          };
+          p.resume_when_arg = future;
+        }
+        void await_resume() const noexcept {
+        }
+      };
+
+      /// Suspends only if the current resume has used up its budget
+      struct budget_check {
+        bool ready = true;
+
+        bool await_ready() const noexcept {
+          return false;
+        }
+        bool await_suspend(task::handle_type h) noexcept {
+          auto budget = h.promise().budget;
+          if (is_valid(budget) && !budget->adjust_spent()) {
+            h.promise().suspended_with = resumable::reschedule{};
+            return true;
+          }
+          return false;
+        }
+        void await_resume() const noexcept {
+        }
+      };
+    }
+
+    inline detail::suspend_with readable(i32 fd) {
+      return {resumable::blocked::port{fd, resumable::blocked::port::READ}};
+    }
+
+    inline detail::suspend_with writable(i32 fd) {
+      return {resumable::blocked::port{fd, resumable::blocked::port::WRITE}};
+    }
+
+    inline detail::suspend_with sleep_for(nanoseconds ns) {
+      return {resumable::blocked::sleep{ns}};
+    }
+
+    /// Goes to the back of the ready queue
+    inline detail::suspend_with reschedule() {
+      return {resumable::reschedule{}};
+    }
+
+    /// Reschedules if the worker wants the time back, else carries on
+    inline detail::budget_check maybe_reschedule() {
+      return {};
+    }
+
+    template < class F >
+    detail::until_ready< F > ready(F& future) {
+      return {edit(future)};
+    }
+
+    /// Runs the coroutine returned by f(args...) on the runtime
+    template < class F, class... Args >
+    void spawn_coroutine(F&& f, Args&&... args) {
+      runtime.spawn(own< resumable >{make< coroutine_resumable >(
+          forward< F >(f)(forward< Args >(args)...))});
+    }
+
+    inline task task::promise_type::get_return_object() {
+      return task{handle_type::from_promise(*this)};
+    }
+
+    inline ::std::suspend_always task::promise_type::initial_suspend() noexcept {
+      return {};
+    }
+
+    inline ::std::suspend_always task::promise_type::final_suspend() noexcept {
+      return {};
+    }
+
+    inline void task::promise_type::return_void() {
+    }
+
+    inline void task::promise_type::unhandled_exception() {
+      /// Same as an exception escaping a worker, see worker::run
+      ::std::terminate();
+    }
+
+    inline task::task(handle_type h) : _handle(h) {
+    }
+
+    inline task::task(task&& other) : _handle(other._handle) {
+      other._handle = nullptr;
+    }
+
+    inline task& task::operator=(task&& other) {
+      if (this != &other) {
+        if (_handle) {
+          _handle.destroy();
+        }
+        _handle       = other._handle;
+        other._handle = nullptr;
+      }
+      return *this;
+    }
+
+    inline task::~task() {
+      if (_handle) {
+        _handle.destroy();
+      }
+    }
+
+    inline auto task::handle() const -> handle_type {
+      return _handle;
+    }
+
+    inline coroutine_resumable::coroutine_resumable(task t) : _task(move(t)) {
+      assert(_task.handle());
+    }
+
+    inline auto coroutine_resumable::resume(mut< execution_budget > budget)
+        -> result {
+      auto h   = _task.handle();
+      auto&& p = h.promise();
+      assert(!h.done());
+      if (p.resume_when) {
+        if (!p.resume_when(p.resume_when_arg)) {
+          return reschedule{};
+        }
+        p.resume_when = nullptr;
+      }
+      p.budget = budget;
+      h.resume();
+      p.budget = nullptr;
+      if (h.done()) {
+        return done{};
+      }
+      return p.suspended_with;
+    }
+
+    inline void coroutine_resumable::yield(result) {
+      assert(false && "Coroutines suspend with co_await");
+    }
+  }
+}
+}
+
+#endif
@@ -5,13 +5,6 @@
 namespace xi {
 namespace core {
   namespace detail {
-    // using block_queue_type =
-    //   intrusive::list< resumable,
-    //                    intrusive::member_hook< resumable,
-    //                                            block_hook_type,
-    //                                            &resumable::block_hook >,
-    //                    intrusive::constant_time_size< false > >;
-
     using ready_hook_type = intrusive::list_member_hook<
         intrusive::link_mode< intrusive::auto_unlink > >;
 
@@ -21,15 +14,22 @@ namespace core {
         intrusive::member_hook< T, ready_hook_type, &T::ready_hook >,
         intrusive::constant_time_size< false > >;
 
-    using sleep_hook_type = intrusive::set_member_hook<
-        intrusive::link_mode< intrusive::auto_unlink > >;
+    /// Not auto_unlink, a resumable may only leave a timer_wheel through
+    /// the wheel, which keeps count of them
+    using timer_hook_type = intrusive::list_member_hook<
+        intrusive::link_mode< intrusive::safe_link > >;
 
     template < class T >
-    using sleep_queue_type = intrusive::set<
+    using timer_slot_type = intrusive::list<
         T,
-        intrusive::member_hook< T, sleep_hook_type, &T::sleep_hook >,
-        intrusive::constant_time_size< false >,
-        intrusive::compare< typename T::timepoint_less > >;
+        intrusive::member_hook< T, timer_hook_type, &T::sleep_hook >,
+        intrusive::constant_time_size< false > >;
+
+    /// Link of the intrusive MPSC queue resumables are handed between
+    /// workers through
+    struct handoff_hook_type {
+      atomic< handoff_hook_type* > next{nullptr};
+    };
   }
 }
 }
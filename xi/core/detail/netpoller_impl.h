@@ -0,0 +1,45 @@
+#pragma once
+
+#include "xi/ext/configure.h"
+#include "xi/core/netpoller.h"
+
+namespace xi {
+namespace core {
+  namespace v2 {
+
+    /// Interface of netpoller backends. Only the owning worker may call
+    /// anything but poll_into with on_behalf set, pending and
+    /// unblock_one.
+    class netpoller::impl {
+    public:
+      virtual ~impl() = default;
+
+      virtual void await_readable(resumable* r, i32 fd) = 0;
+      virtual void await_writable(resumable* r, i32 fd) = 0;
+      /// Returns the number of resumables put into the queue. When
+      /// polling on behalf of the owner, everything available is drained,
+      /// and its wakeup and timer events are left alone, as they are
+      /// only meaningful to the owner. Nobody may poll on behalf of an
+      /// owner that is running, as it would take edges it is waiting for.
+      virtual usize poll_into(mut< worker_queue > queue,
+                              usize n,
+                              bool block,
+                              bool on_behalf) = 0;
+      virtual usize poll_until(mut< worker_queue > queue,
+                               usize n,
+                               steady_clock::time_point deadline) = 0;
+      virtual void flush()          = 0;
+      virtual usize pending() const = 0;
+      /// Becomes readable whenever there is something to poll
+      virtual i32 native_handle() const = 0;
+      virtual void unblock_one()        = 0;
+    };
+
+#ifdef XI_HAS_IO_URING
+    /// Returns nullptr when the kernel won't give us a ring
+    shared_ptr< netpoller::impl > make_uring_netpoller(
+        ref< netpoller::config >);
+#endif
+  }
+}
+}
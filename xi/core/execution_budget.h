@@ -1,53 +1,58 @@
 #pragma once
 
 #include "xi/ext/configure.h"
+#include "xi/hw/tsc.h"
 
 namespace xi {
 namespace core {
   namespace v2 {
 
-    /// TODO: Needs compatibitily check
+    using hw::read_tsc;
+
+    /// Amount of time a piece of work is allowed to run for. Time is
+    /// taken from the calibrated TSC where possible, so that budgets mean
+    /// the same on every machine.
     class execution_budget {
-      usize _allocated;
-      usize _jitter;
-      usize _start_tsc;
-      usize _curr_tsc;
+      nanoseconds _allocated;
+      nanoseconds _jitter;
+      u64 _start_ns;
+      u64 _curr_ns;
 
     public:
-      execution_budget(usize a, usize jitter = 0)
+      execution_budget(nanoseconds a, nanoseconds jitter = nanoseconds(0))
           : _allocated(a)
           , _jitter(jitter)
-          , _start_tsc(_rdtscl())
-          , _curr_tsc(_start_tsc) {
+          , _start_ns(hw::monotonic_ns())
+          , _curr_ns(_start_ns) {
       }
 
       bool adjust_spent() {
-        _curr_tsc = _rdtscl();
+        _curr_ns = hw::monotonic_ns();
         return !is_expended();
       }
 
-      usize remainder() const {
-        return ((_curr_tsc + _jitter) - _start_tsc) - _allocated;
+      /// Part of the allocation that is yet to be spent
+      nanoseconds remainder() const {
+        auto used = spent() + _jitter;
+        return used >= _allocated ? nanoseconds(0) : _allocated - used;
+      }
+
+      nanoseconds spent() const {
+        return nanoseconds(_curr_ns - _start_ns);
       }
 
       bool is_expended() const {
-        return (_curr_tsc + _jitter) - _start_tsc >= _allocated;
+        return spent() + _jitter >= _allocated;
       }
 
-      execution_budget sub_budget(usize a) {
+      execution_budget sub_budget(nanoseconds a) {
         return execution_budget(
-            min(remainder(), a), _jitter, _start_tsc, _rdtscl());
+            min(remainder(), a), _jitter, _start_ns, hw::monotonic_ns());
       }
 
     private:
-      execution_budget(usize a, usize jitter, usize start, usize curr)
-          : _allocated(a), _jitter(jitter), _start_tsc(start), _curr_tsc(curr) {
-      }
-
-      usize _rdtscl() {
-        unsigned int lo, hi;
-        __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
-        return ((usize)lo) | (((usize)hi) << 32);
+      execution_budget(nanoseconds a, nanoseconds jitter, u64 start, u64 curr)
+          : _allocated(a), _jitter(jitter), _start_ns(start), _curr_ns(curr) {
       }
     };
   }
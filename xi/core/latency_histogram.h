@@ -0,0 +1,142 @@
+#pragma once
+
+#include "xi/ext/configure.h"
+
+namespace xi {
+namespace core {
+  namespace v2 {
+
+    /// Bucket layout shared by live histograms and their snapshots.
+    ///
+    /// Values below SUB_BUCKETS get a bucket each, every power of two
+    /// above that is split into SUB_BUCKETS linear buckets. A recorded
+    /// value is thus off by at most 1/SUB_BUCKETS of itself, at a fixed
+    /// cost of BUCKETS counters.
+    struct log_linear_buckets {
+      enum : u64 {
+        SUB_BUCKET_BITS = 3,
+        SUB_BUCKETS     = 1 << SUB_BUCKET_BITS,
+        /// Anything from 2^MAX_EXPONENT ns (~73 minutes) up ends up in
+        /// the last bucket
+        MAX_EXPONENT = 42,
+        BUCKETS      = (MAX_EXPONENT - SUB_BUCKET_BITS + 1) * SUB_BUCKETS,
+      };
+
+      static usize index_of(u64 value);
+      static u64 lower_bound_of(usize index);
+      static u64 upper_bound_of(usize index);
+    };
+
+    /// Plain copy of a histogram, for reporting and merging.
+    struct latency_snapshot {
+      array< u64, log_linear_buckets::BUCKETS > counts = {};
+      u64 total  = 0;
+      u64 sum_ns = 0;
+      u64 max_ns = 0;
+
+      void merge(ref< latency_snapshot >);
+      nanoseconds mean() const;
+      nanoseconds max() const;
+      /// Upper bound of the bucket holding the given quantile, e.g. 0.999
+      nanoseconds percentile(double) const;
+    };
+
+    /// Lock-free histogram of durations. Only one thread may record into
+    /// it, any thread may take snapshots.
+    class latency_histogram : public ownership::unique {
+      array< atomic< u64 >, log_linear_buckets::BUCKETS > _counts = {};
+      atomic< u64 > _sum_ns{0};
+      atomic< u64 > _max_ns{0};
+
+    public:
+      void record(nanoseconds);
+      latency_snapshot snapshot() const;
+    };
+
+    inline usize log_linear_buckets::index_of(u64 value) {
+      if (value < SUB_BUCKETS) {
+        return value;
+      }
+      u64 exponent = 63 - count_leading_zeroes(value);
+      if (exponent >= MAX_EXPONENT) {
+        return BUCKETS - 1;
+      }
+      auto sub = (value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+      return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+    }
+
+    inline u64 log_linear_buckets::lower_bound_of(usize index) {
+      if (index < SUB_BUCKETS) {
+        return index;
+      }
+      auto group = index / SUB_BUCKETS;
+      auto sub   = index % SUB_BUCKETS;
+      return (SUB_BUCKETS + sub) << (group - 1);
+    }
+
+    inline u64 log_linear_buckets::upper_bound_of(usize index) {
+      if (index + 1 >= BUCKETS) {
+        return numeric_limits< u64 >::max();
+      }
+      return lower_bound_of(index + 1) - 1;
+    }
+
+    inline void latency_snapshot::merge(ref< latency_snapshot > other) {
+      for (auto i : range::to< usize >(log_linear_buckets::BUCKETS)) {
+        counts[i] += other.counts[i];
+      }
+      total += other.total;
+      sum_ns += other.sum_ns;
+      max_ns = ::std::max(max_ns, other.max_ns);
+    }
+
+    inline nanoseconds latency_snapshot::mean() const {
+      return nanoseconds(total ? sum_ns / total : 0);
+    }
+
+    inline nanoseconds latency_snapshot::max() const {
+      return nanoseconds(max_ns);
+    }
+
+    inline nanoseconds latency_snapshot::percentile(double q) const {
+      if (!total) {
+        return nanoseconds(0);
+      }
+      auto rank = static_cast< u64 >(q * total);
+      rank      = ::std::min(::std::max< u64 >(rank, 1), total);
+      u64 seen  = 0;
+      for (auto i : range::to< usize >(log_linear_buckets::BUCKETS)) {
+        seen += counts[i];
+        if (seen >= rank) {
+          return nanoseconds(::std::min(
+              log_linear_buckets::upper_bound_of(i), max_ns));
+        }
+      }
+      return max();
+    }
+
+    inline void latency_histogram::record(nanoseconds d) {
+      auto value  = static_cast< u64 >(::std::max(d.count(), 0l));
+      auto&& slot = _counts[log_linear_buckets::index_of(value)];
+      /// Single writer, no need for read-modify-write instructions
+      slot.store(slot.load(memory_order_relaxed) + 1, memory_order_relaxed);
+      _sum_ns.store(_sum_ns.load(memory_order_relaxed) + value,
+                    memory_order_relaxed);
+      if (value > _max_ns.load(memory_order_relaxed)) {
+        _max_ns.store(value, memory_order_relaxed);
+      }
+    }
+
+    inline latency_snapshot latency_histogram::snapshot() const {
+      latency_snapshot s;
+      for (auto i : range::to< usize >(log_linear_buckets::BUCKETS)) {
+        s.counts[i] = _counts[i].load(memory_order_relaxed);
+        s.total += s.counts[i];
+      }
+      s.sum_ns = _sum_ns.load(memory_order_relaxed);
+      s.max_ns = _max_ns.load(memory_order_relaxed);
+      return s;
+    }
+  }
+}
+}
@@ -7,16 +7,63 @@ namespace xi {
 namespace core {
   namespace v2 {
     class netpoller : public virtual ownership::unique {
+    public:
+      enum class backend {
+        EPOLL,
+        /// Falls back to epoll when io_uring is not available
+        IO_URING,
+      };
+
+      struct config {
+        backend kind;
+        /// Submission queue size of io_uring
+        u32 queue_depth;
+        /// Have a kernel thread pick up io_uring submissions
+        bool sq_poll;
+        /// How long the kernel thread spins before going to sleep
+        u32 sq_poll_idle_ms;
+      };
+      static config DEFAULT_CONFIG;
+
       class impl;
+
+    private:
       shared_ptr< impl > _impl;
+      backend _backend = backend::EPOLL;
 
     public:
-      void start();
+      void start(config = DEFAULT_CONFIG);
       void stop();
       void await_readable(i32, own< resumable >);
       void await_writable(i32, own< resumable >);
+      /// Returns the number of resumables put into the queue
       usize poll_into(mut< worker_queue >, usize);
       usize blocking_poll_into(mut< worker_queue >, usize);
+      /// Blocks until there are events, or until the deadline passes
+      usize blocking_poll_into(mut< worker_queue >,
+                               usize,
+                               steady_clock::time_point deadline);
+      /// Hands interest registered so far over to the kernel. Needed
+      /// before somebody else starts polling on our behalf.
+      void flush();
+      backend kind() const;
+      /// Number of resumables blocked on ports of this netpoller
+      usize pending() const;
+      /// Reports events of another netpoller as if they were our own.
+      /// Polling this one then drains the other on its behalf, which is
+      /// only allowed while its owner doesn't poll it itself, e.g. while
+      /// parked. Only supported by the epoll backend, as it is safe to
+      /// poll from any thread.
+      void watch(mut< netpoller >);
+      /// Stops watching the other netpoller. Nobody polls it on its
+      /// behalf anymore once this returns.
+      void unwatch(mut< netpoller >);
+      /// Has to be called before closing an fd any netpoller may have
+      /// seen. An fd is registered with the kernel once, on its first
+      /// wait, and that registration is trusted until forgotten. Without
+      /// this, the next fd with the same number would never be
+      /// registered and its waiters never resumed.
+      static void forget(i32 fd);
       void unblock_one(); // TODO: Feels weird here, should probably be
                            // somewhere else
     };
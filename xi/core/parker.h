@@ -0,0 +1,28 @@
+#pragma once
+
+#include "xi/ext/configure.h"
+
+namespace xi {
+namespace core {
+  namespace v2 {
+
+    /// Futex backed wakeup token for a single thread to block on.
+    ///
+    /// An unpark issued before the owner gets to park is not lost, the
+    /// following park returns immediately. Unparking a thread that isn't
+    /// blocked costs an atomic exchange, the futex is only woken when
+    /// somebody actually sleeps on it.
+    class parker : public ownership::unique {
+      enum : i32 { PARKED = -1, EMPTY = 0, NOTIFIED = 1 };
+      atomic< i32 > _state{EMPTY};
+
+    public:
+      /// Owner only. Returns once unparked, or once the deadline passes.
+      void park(
+          steady_clock::time_point deadline = steady_clock::time_point::max());
+      /// Any thread
+      void unpark();
+    };
+  }
+}
+}
@@ -4,6 +4,9 @@
 #include "xi/ext/lockfree.h"
 #include "xi/core/detail/intrusive.h"
 #include "xi/core/reactor/epoll.h"
+#include "xi/core/reactor/simulated.h"
+#include "xi/core/simulation.h"
+#include "xi/core/stall_detector.h"
 #include "xi/core/worker.h"
 #include "xi/util/spin_lock.h"
 
@@ -43,6 +46,33 @@ namespace core {
       }
     };
 
+    /// Virtual time of the simulation, see reactor::simulated
+    class simulated_time_authority {
+    public:
+      using clock_type      = steady_clock;
+      using time_point_type = steady_clock::time_point;
+
+      static time_point_type max() noexcept {
+        return time_point_type::max();
+      }
+
+      static nanoseconds max_duration() noexcept {
+        return (max() - now());
+      }
+
+      static nanoseconds duration_till(time_point_type tp) noexcept {
+        return (tp - simulation::now());
+      }
+
+      static time_point_type now() noexcept {
+        return simulation::now();
+      }
+
+      static time_point_type now_plus(nanoseconds ns) noexcept {
+        return simulation::now() + ns;
+      }
+    };
+
     template < class Reactor, class TimeAuthority >
     class generic_worker_isolation {
       struct worker_data {
@@ -88,11 +118,11 @@ namespace core {
       }
 
       void begin_task(worker_access_t* w, resumable*) {
-        // w->data().reactor.begin_task_quota_monitor(10ms);
+        w->data().reactor.begin_task_quota_monitor(stall_detector::quota());
       }
 
       void end_task(worker_access_t* w, resumable*) {
-        // w->data().reactor.end_task_quota_monitor();
+        w->data().reactor.end_task_quota_monitor();
       }
 
       void push_externally(worker_access_t* w, resumable* r) {
@@ -213,6 +243,12 @@ namespace core {
 
     using worker_isolation =
         generic_worker_isolation< reactor::epoll, steady_clock_authority >;
+
+    /// Replays the same way for the same simulation::reset() seed, and
+    /// sleeps take no wall clock time
+    using simulated_worker_isolation =
+        generic_worker_isolation< reactor::simulated,
+                                  simulated_time_authority >;
   }
 }
 }
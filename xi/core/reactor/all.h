@@ -2,3 +2,4 @@
 
 #include "xi/core/reactor/abstract_reactor.h"
 #include "xi/core/reactor/epoll.h"
+#include "xi/core/reactor/simulated.h"
@@ -17,6 +17,8 @@ namespace core {
       // detail::block_queue_type* _signal_queues;
       pthread_t _thread_id;
       timer_t _quota_timer;
+      /// Quota the stall check timer is currently armed for
+      nanoseconds _armed_quota = 0ns;
 
     public:
       epoll();
@@ -26,8 +28,13 @@ namespace core {
       void await_readable(i32) override;
       void await_writable(i32) override;
       void maybe_wakeup();
+      /// Marks the start of a slice that shouldn't run longer than the
+      /// given quota, overruns are reported by the stall_detector
       void begin_task_quota_monitor(nanoseconds);
       void end_task_quota_monitor();
+
+    private:
+      void _disarm_quota_timer();
     };
   }
 }
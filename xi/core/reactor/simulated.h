@@ -0,0 +1,43 @@
+#pragma once
+
+#include "xi/ext/configure.h"
+#include "xi/core/reactor/abstract_reactor.h"
+
+namespace xi {
+namespace core {
+  class resumable;
+
+  namespace reactor {
+    /// Stands in for epoll when workers run under the simulation. There
+    /// is no real I/O, whoever waits on a descriptor is resumed once
+    /// somebody posts it. Polling hands the thread over to the
+    /// simulation, which only lets time pass when every worker waits.
+    class simulated : public abstract_reactor {
+      usize _id;
+      /// Posts may come from any thread
+      mutex _lock;
+      unordered_map< i32, resumable* > _waiters;
+      /// Posts nobody has waited for yet, in order
+      vector< i32 > _posted;
+
+    public:
+      simulated();
+      ~simulated();
+
+      void poll_for(nanoseconds) override;
+      void await_readable(i32) override;
+      void await_writable(i32) override;
+      void maybe_wakeup();
+      /// Makes the descriptor ready, resuming whoever waits on it, or
+      /// whoever waits on it next
+      void post(i32 fd);
+      /// Virtual time never stalls
+      void begin_task_quota_monitor(nanoseconds);
+      void end_task_quota_monitor();
+
+    private:
+      void _await(i32 fd);
+    };
+  }
+}
+}
@@ -1,34 +1,29 @@
 #pragma once
 
 #include "xi/ext/configure.h"
+#include "xi/core/affinity.h"
 #include "xi/core/detail/intrusive.h"
 #include "xi/core/execution_budget.h"
+#include "xi/core/scheduling_group.h"
 
 namespace xi {
 namespace core {
   namespace v2 {
-    struct resumable_stat {
-      nanoseconds blocked = 0ns;
-      nanoseconds running = 0ns;
-      u64 running_count   = 0;
-      nanoseconds polling = 0ns;
-      u64 polling_count   = 0;
-    };
-    extern thread_local resumable_stat RESUMABLE_STAT;
-
     class resumable : public virtual ownership::unique {
     public:
       detail::ready_hook_type ready_hook;
-      detail::sleep_hook_type sleep_hook;
+      detail::timer_hook_type sleep_hook;
       steady_clock::time_point _wakeup_time = steady_clock::time_point::max();
-
-      struct timepoint_less {
-        bool operator()(resumable const& l, resumable const& r) noexcept {
-          return l._wakeup_time < r._wakeup_time;
-        }
-      };
+      /// Monotonic nanoseconds at which the resumable became ready, zero
+      /// while it is running or blocked
+      u64 _ready_since = 0;
+      detail::handoff_hook_type handoff_hook;
+      affinity _affinity;
+      scheduling_group _group = scheduling_group::NORMAL;
 
       struct blocked {
+        /// Only a single resumable may wait for each direction of an
+        /// fd at a time, and the fd has to stay open until it is resumed
         struct port {
           i32 fd;
           enum { READ, WRITE } type;
@@ -40,6 +35,12 @@ namespace core {
 
       steady_clock::time_point wakeup_time() const;
       void wakeup_time(steady_clock::time_point);
+      u64 ready_since() const;
+      void ready_since(u64);
+      affinity affinity_hint() const;
+      void affinity_hint(affinity);
+      scheduling_group group() const;
+      void group(scheduling_group);
       struct reschedule {};
       struct done {};
       using result = variant< blocked::port, blocked::sleep, reschedule, done >;
@@ -58,6 +59,30 @@ namespace core {
     inline void resumable::wakeup_time(steady_clock::time_point when) {
       _wakeup_time = when;
     }
+
+    inline u64 resumable::ready_since() const {
+      return _ready_since;
+    }
+
+    inline void resumable::ready_since(u64 ns) {
+      _ready_since = ns;
+    }
+
+    inline affinity resumable::affinity_hint() const {
+      return _affinity;
+    }
+
+    inline void resumable::affinity_hint(affinity a) {
+      _affinity = a;
+    }
+
+    inline scheduling_group resumable::group() const {
+      return _group;
+    }
+
+    inline void resumable::group(scheduling_group g) {
+      _group = g;
+    }
   }
 
   class abstract_worker;
@@ -65,6 +90,16 @@ namespace core {
   namespace detail {
     using block_hook_type = intrusive::list_member_hook<
         intrusive::link_mode< intrusive::auto_unlink > >;
+
+    using sleep_hook_type = intrusive::set_member_hook<
+        intrusive::link_mode< intrusive::auto_unlink > >;
+
+    template < class T >
+    using sleep_queue_type = intrusive::set<
+        T,
+        intrusive::member_hook< T, sleep_hook_type, &T::sleep_hook >,
+        intrusive::constant_time_size< false >,
+        intrusive::compare< typename T::timepoint_less > >;
   }
 
   class resumable : public virtual ownership::unique {
@@ -73,7 +108,7 @@ namespace core {
 
   public:
     struct timepoint_less {
-      bool operator()(resumable const& l, resumable const& r) noexcept {
+      bool operator()(resumable const& l, resumable const& r) const noexcept {
         return l._wakeup_time < r._wakeup_time;
       }
     };
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "xi/ext/configure.h"
+#include "xi/core/affinity.h"
 #include "xi/core/resumable.h"
 
 namespace xi {
@@ -8,10 +9,23 @@ namespace core {
   namespace v2 {
 
     class resumable_builder : public virtual ownership::unique {
+      affinity _affinity;
+
     public:
       virtual ~resumable_builder()     = default;
       virtual own< resumable > build() = 0;
+
+      affinity affinity_hint() const;
+      void affinity_hint(affinity);
     };
+
+    inline affinity resumable_builder::affinity_hint() const {
+      return _affinity;
+    }
+
+    inline void resumable_builder::affinity_hint(affinity a) {
+      _affinity = a;
+    }
   }
 }
 }
@@ -8,6 +8,8 @@
 namespace xi {
 namespace core {
   namespace v2 {
+    struct worker_stats_snapshot;
+
     class runtime_environment {
       class impl;
       shared_ptr< impl > _impl;
@@ -16,11 +18,18 @@ namespace core {
       runtime_environment();
       ~runtime_environment();
       void spawn(own<resumable_builder>);
+      /// Hands an already constructed resumable to a worker, without any
+      /// further allocation
+      void spawn(own< resumable >);
       void set_cores(u8);
 
       void sleep_current_resumable(nanoseconds);
       void await_readable(i32);
       void await_writable(i32);
+      /// Latency distributions merged across every worker
+      worker_stats_snapshot stats();
+      /// Dumps recent scheduler events in Chrome trace format
+      void write_trace(::std::ostream&);
     };
 
     extern runtime_environment runtime;
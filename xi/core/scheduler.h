@@ -2,10 +2,16 @@
 
 #include "xi/ext/configure.h"
 #include "xi/ext/barrier.h"
+#include "xi/hw/hardware.h"
+#include "xi/hw/tsc.h"
 #include "xi/core/netpoller.h"
+#include "xi/core/parker.h"
 #include "xi/core/resumable.h"
 #include "xi/core/shared_queue.h"
+#include "xi/core/sleep_queue.h"
 #include "xi/core/worker2.h"
+#include "xi/core/worker_set.h"
+#include "xi/util/spin_lock.h"
 
 namespace xi {
 namespace core {
@@ -18,6 +24,16 @@ namespace core {
         auto r = pthread_setaffinity_np(pthread_self(), sizeof(cs), &cs);
         assert(r == 0);
       }
+
+      /// xorshift64*, only used to spread out victim selection
+      static u64 fast_random() {
+        thread_local static u64 STATE =
+            ::std::hash< thread::id >{}(::std::this_thread::get_id()) | 1;
+        STATE ^= STATE >> 12;
+        STATE ^= STATE << 25;
+        STATE ^= STATE >> 27;
+        return STATE * 2685821657736338717ull;
+      }
     }
 
     class scheduler : public virtual ownership::unique {
@@ -25,7 +41,18 @@ namespace core {
         RUNNING,
         PARKED_NETPOLL,
         PARKED_THREAD,
-        SPINNING
+        SPINNING,
+        RETIRED
+      };
+
+      /// Read by whoever wants to wake the worker up, so it has to be
+      /// shared and stable in memory
+      struct parking_spot {
+        atomic< worker_state > state{worker_state::RUNNING};
+        /// Set by the scheduler, the worker retires once it runs out of
+        /// work and stays that way until this is cleared
+        atomic< bool > retire{false};
+        parker thread_parker;
       };
 
       struct worker_control_block {
@@ -35,50 +62,178 @@ namespace core {
         /// These two queues should only be mutated when the worker requests it.
         mut< worker_queue > ready_queue;
         mut< worker_queue > port_queue;
+        /// Safe to use from any worker
+        mut< steal_queue > stealable_queue;
+        mut< worker_load > load;
+        /// Written by the worker only, merged on demand
+        mut< worker_stats > stats;
+        u16 numa_node;
         worker::config worker_config;
-        unique_ptr< mutex > worker_mutex;
-        unique_ptr< condition_variable > worker_cv;
-        worker_state state;
+        unique_ptr< parking_spot > parking;
+        /// Owned here rather than by the worker thread, so that the
+        /// pointers above stay valid for other threads after it exits
+        own< netpoller > poller_storage;
+        unique_ptr< worker > worker_storage;
       };
 
       unique_ptr< barrier > _barrier;
       vector< thread > _threads;
 
+      /// Watches the netpollers of parked and retired workers with ports
+      /// outstanding. Only the last worker to park blocks on it, running
+      /// workers poll it while somebody is parked with ports outstanding.
       own< netpoller > _netpoller;
+      spin_lock _netpoller_lock;
+      shared_sleep_queue _central_sleep_queue;
 
       alignas(64) vector< worker_control_block > _workers;
-      atomic< u64 > _parked_workers{0};
-      atomic< u64 > _active_workers{0};
+      /// Workers that new work can be placed on
+      worker_set _admitted;
+      /// Admitted workers on each NUMA node, indexed by node
+      vector< worker_set > _node_workers;
+      worker_set _parked_workers;
+      /// Parked or retired workers with resumables blocked on their ports
+      worker_set _parked_on_ports;
+      /// Workers that are neither parked nor retired
+      atomic< usize > _running_workers{0};
+
+    public:
+      struct config {
+        /// Workers are retired while utilisation stays low and readmitted
+        /// once it stays high, but never more than were started. Off by
+        /// default, as it moves keyed work between workers, along with
+        /// the ports and sleepers of whoever retires.
+        struct {
+          bool enabled;
+          /// Mean utilisation of admitted workers, in 1/1024ths
+          u32 shrink_below;
+          u32 grow_above;
+          /// How long utilisation has to stay past a threshold before
+          /// acting on it, and between consecutive changes
+          nanoseconds sustain;
+          usize min_workers;
+        } elastic;
+      };
+      static config DEFAULT_CONFIG;
+
+    private:
+      config _config;
+      spin_lock _review_lock;
+      u64 _last_review_ns = 0;
+      /// Since when utilisation has been past a threshold, zero if not
+      u64 _low_since_ns  = 0;
+      u64 _high_since_ns = 0;
 
     public:
-      void start(u16 core_start, u16 core_end); // TODO: Change to range
+      void start(u16 core_start,
+                 u16 core_end,
+                 config = DEFAULT_CONFIG); // TODO: Change to range
       void join();
       void central_enqueue(own< resumable_builder >);
+      void central_enqueue(own< resumable >);
       void idle_worker(mut< worker >);
+      void work_available();
       void central_sleep(own< resumable >, steady_clock::time_point);
+      usize central_wakeup(steady_clock::time_point now);
+      usize central_poll();
+      /// Latency distributions of all running workers merged together
+      worker_stats_snapshot stats() const;
+      /// Recent events of every running worker, empty unless built with
+      /// XI_HAS_TRACE
+      vector< trace_thread > trace() const;
+      /// Stops placing work on the worker. It hands whatever it holds over
+      /// to the others and sleeps until readmitted. Serialized with
+      /// review_workers, which makes the same decisions.
+      void retire(usize idx);
+      void readmit(usize idx);
+      usize admitted_workers() const;
+      /// Retires or readmits a worker if utilisation calls for it, called
+      /// by workers as they report their load
+      void review_workers();
 
     private:
+      void _retire(mut< worker >);
+      /// Same as retire and readmit, with _review_lock held
+      void _retire_locked(usize idx);
+      void _readmit_locked(usize idx);
+      bool _steal_into(mut< worker >);
       void _park(mut< worker >);
-      mut< worker_control_block > _worker_for_job(ref< resumable_builder >);
-      opt< mut< worker_control_block > > _first_parked_worker();
-      mut< worker_control_block > _least_loaded_worker();
+      void _unpark(mut< worker_control_block >);
+      /// Lets running workers poll ports of a worker that stops polling
+      /// them itself, and takes them back once it does again
+      void _lend_ports(usize idx);
+      void _reclaim_ports(usize idx);
+      void _hand_off(mut< worker_queue >);
+      mut< worker_control_block > _worker_for_job(affinity);
+      opt< mut< worker_control_block > > _first_parked_worker(
+          ref< worker_set > preferred);
+      mut< worker_control_block > _least_loaded_worker(ref< worker_set > among);
+      /// Admitted workers on the NUMA node of the calling worker, or all
+      /// of them when called from outside of the scheduler or when none
+      /// are left on the node
+      ref< worker_set > _local_workers() const;
+      mut< worker_control_block > _least_loaded_worker_on_node(u16 node);
     };
 
-    inline void scheduler::start(u16 core_start, u16 core_end) {
+    inline void scheduler::start(u16 core_start, u16 core_end, config c) {
       assert(core_end >= core_start);
       auto cores = core_end - core_start;
       _barrier   = make_unique< barrier >(cores + 1);
+      _config    = move(c);
 
       _workers.resize(cores);
+      auto machine = hw::enumerate();
+      /// Calibrating may take a few milliseconds, which would otherwise
+      /// be spent in the first clock read of whichever worker gets there
+      /// first
+      hw::tsc();
+
+      /// Known up front, so that placement never sees a half built map
+      _admitted        = worker_set(cores);
+      _parked_workers  = worker_set(cores);
+      _parked_on_ports = worker_set(cores);
+      _node_workers.clear();
+      for (auto idx : range::to(cores)) {
+        usize cpu = core_start + idx;
+        u16 node = cpu < machine.cpus().size()
+                       ? max< int >(machine.core(cpu).id().numa, 0)
+                       : 0;
+        while (node >= _node_workers.size()) {
+          _node_workers.emplace_back(cores);
+        }
+        _node_workers[node].insert(idx);
+        _admitted.insert(idx);
+        _workers[idx].numa_node = node;
+      }
+
+      /// Polled from several threads at once, which only epoll allows
+      auto shared_config = netpoller::DEFAULT_CONFIG;
+      shared_config.kind = netpoller::backend::EPOLL;
+      _netpoller         = make< netpoller >();
+      _netpoller->start(shared_config);
+
+      /// Nothing to prefer on a single node, or for a node the kernel
+      /// doesn't know about
+      auto numa_nodes = hw::numa_nodes();
+      for (auto idx : range::to(cores)) {
+        u16 cpu  = core_start + idx;
+        u16 node = _workers[idx].numa_node;
+        _threads.emplace_back([this, cpu, node, idx, numa_nodes] {
+          /// Everything the worker owns is allocated from here on, keep
+          /// it on the node the worker runs on
+          pin(cpu);
+          if (numa_nodes > 1 && node < numa_nodes) {
+            hw::prefer_numa_node(node);
+          }
 
-      for (auto cpu : range::to(cores)) {
-        _threads.emplace_back([ this, cpu, idx = cpu - core_start ] {
           auto worker_queue = make< shared_queue >();
 
           auto poller = make< netpoller >();
           poller->start();
 
-          worker w(edit(poller), edit(worker_queue), this, idx);
+          auto storage = make_unique< worker >(
+              edit(poller), edit(worker_queue), this, idx);
+          auto& w       = *storage;
           _workers[idx] = {
               // mut<worker> w;
               edit(w),
@@ -90,24 +245,42 @@ namespace core {
               w.ready_queue(),
               // mut< worker_queue > port_queue;
               w.port_queue(),
+              // mut< steal_queue > stealable_queue;
+              w.stealable_queue(),
+              // mut< worker_load > load;
+              w.load(),
+              // mut< worker_stats > stats;
+              w.stats(),
+              // u16 numa_node;
+              node,
               // worker::config worker_config;
               worker::DEFAULT_CONFIG,
-              // unique_ptr<mutex> worker_mutex;
-              make_unique< mutex >(),
-              // unique_ptr<condition_variable> worker_cv;
-              make_unique< condition_variable >(),
-              // worker_state state;
-              worker_state::RUNNING,
+              // unique_ptr< parking_spot > parking;
+              make_unique< parking_spot >(),
+              // own< netpoller > poller_storage;
+              move(poller),
+              // unique_ptr< worker > worker_storage;
+              move(storage),
           };
           LOCAL_WORKER = edit(w);
-          // printf("Pinning thread %p to core %d.\n", pthread_self(), cpu);
-          pin(cpu);
-          _active_workers.fetch_or(1ul << idx, memory_order_release);
+          _running_workers.fetch_add(1, memory_order_release);
           _barrier->wait();
           w.run(); // TODO: Handle exceptions
 
-          // TODO: clean up
-          _workers[idx].w = nullptr;
+          /// Nothing gets placed here anymore and whatever is still queued
+          /// goes to the other workers. The queues themselves stay, thieves
+          /// and stats readers may still be looking at them.
+          {
+            _review_lock.lock();
+            XI_SCOPE(exit) {
+              _review_lock.unlock();
+            };
+            _admitted.erase(idx);
+            _node_workers[node].erase(idx);
+          }
+          v2::worker_queue evicted;
+          w.evacuate(edit(evicted));
+          _hand_off(edit(evicted));
         });
       }
       _barrier->wait();
@@ -124,102 +297,507 @@ namespace core {
     inline void scheduler::central_enqueue(own< resumable_builder > rb) {
       // printf("%s\n", __PRETTY_FUNCTION__);
       /// Unpark a worker and schedule this work on it
-      auto w = _worker_for_job(val(rb));
+      auto w = _worker_for_job(rb->affinity_hint());
       w->input_queue->enqueue(move(rb));
-      // printf("The state is %lu.\n", (usize)w->state);
-      if (w->state == worker_state::PARKED_NETPOLL) {
-        // printf("Unparking netpoll.\n");
-        w->poller->unblock_one();
+      /// Pairs with the fence in _park, either we see the worker parked
+      /// or it sees the new work before going to sleep
+      atomic_thread_fence(memory_order_seq_cst);
+      _unpark(w);
+    }
+
+    inline void scheduler::central_enqueue(own< resumable > r) {
+      auto w = _worker_for_job(r->affinity_hint());
+      w->input_queue->enqueue(move(r));
+      /// Pairs with the fence in _park
+      atomic_thread_fence(memory_order_seq_cst);
+      _unpark(w);
+    }
+
+    inline worker_stats_snapshot scheduler::stats() const {
+      worker_stats_snapshot merged;
+      for (auto&& w : _workers) {
+        if (!is_valid(w.stats)) {
+          continue;
+        }
+        merged.merge(w.stats->snapshot());
+      }
+      return merged;
+    }
+
+    inline vector< trace_thread > scheduler::trace() const {
+      vector< trace_thread > threads;
+#if defined(XI_HAS_TRACE)
+      for (auto&& w : _workers) {
+        if (is_valid(w.w)) {
+          threads.push_back({w.w->index(), w.w->trace()->snapshot()});
+        }
       }
-      // } else if (w->state == worker_state::PARKED_THREAD) {
-      //   {
-      //     auto lock = make_unique_lock(*w->worker_mutex);
-      //     w->state  = worker_state::RUNNING;
-      //   }
-      //   w->worker_cv->notify_one();
-      // }
+#endif
+      return threads;
     }
 
+    /// Long sleeps are kept centrally rather than on the worker that
+    /// issued them, so that they can be placed on whichever worker is
+    /// least loaded by the time they wake up.
     inline void scheduler::central_sleep(own< resumable > r,
                                          steady_clock::time_point t) {
-      // return _local_sleep_queue.enqueue(t, move(r));
+      _central_sleep_queue.enqueue(t, move(r));
+    }
+
+    /// Called by workers as they go around their loop. Only one of them
+    /// gets to drain the expired sleepers, the rest return immediately.
+    inline usize scheduler::central_wakeup(steady_clock::time_point now) {
+      worker_queue expired;
+      auto cnt = _central_sleep_queue.dequeue_into(edit(expired), now);
+      _hand_off(edit(expired));
+      return cnt;
+    }
+
+    /// Called by running workers so that events on ports of parked
+    /// workers don't wait for their owners to wake up. Only one of them
+    /// gets to poll at a time.
+    inline usize scheduler::central_poll() {
+      if (_parked_on_ports.is_empty() || !_netpoller_lock.try_lock()) {
+        return 0;
+      }
+      worker_queue ready;
+      {
+        XI_SCOPE(exit) {
+          _netpoller_lock.unlock();
+        };
+        _netpoller->poll_into(edit(ready), numeric_limits< usize >::max());
+      }
+      auto cnt = ready.size();
+      _hand_off(edit(ready));
+      return cnt;
     }
 
     /// The worker has run out of any possible work.
     /// Either steal work from other workers, or park if
     /// none available.
     inline void scheduler::idle_worker(mut< worker > w) {
-      // TODO: Add work stealing and return
+      auto&& spot = *_workers[w->index()].parking;
+      if (spot.retire.load(memory_order_acquire)) {
+        return _retire(w);
+      }
+      if (_steal_into(w)) {
+        return;
+      }
       _park(w);
+      if (spot.retire.load(memory_order_acquire)) {
+        return _retire(w);
+      }
+      /// Whoever woke us up may have done so because there is
+      /// work to take
+      _steal_into(w);
+    }
+
+    inline void scheduler::retire(usize idx) {
+      _review_lock.lock();
+      XI_SCOPE(exit) {
+        _review_lock.unlock();
+      };
+      _retire_locked(idx);
+    }
+
+    inline void scheduler::readmit(usize idx) {
+      _review_lock.lock();
+      XI_SCOPE(exit) {
+        _review_lock.unlock();
+      };
+      _readmit_locked(idx);
+    }
+
+    inline void scheduler::_retire_locked(usize idx) {
+      assert(idx < _workers.size());
+      auto&& w = _workers[idx];
+      /// Somebody has to be left to take the work
+      if (_admitted.count() < 2 || !_admitted.contains(idx) ||
+          w.parking->retire.exchange(true, memory_order_seq_cst)) {
+        return;
+      }
+      _admitted.erase(idx);
+      _node_workers[w.numa_node].erase(idx);
+      /// Pairs with the fence in _park
+      atomic_thread_fence(memory_order_seq_cst);
+      _unpark(edit(w));
+    }
+
+    inline void scheduler::_readmit_locked(usize idx) {
+      assert(idx < _workers.size());
+      auto&& w = _workers[idx];
+      if (!w.parking->retire.exchange(false, memory_order_seq_cst)) {
+        return;
+      }
+      _node_workers[w.numa_node].insert(idx);
+      _admitted.insert(idx);
+      w.parking->thread_parker.unpark();
+    }
+
+    inline usize scheduler::admitted_workers() const {
+      return _admitted.count();
+    }
+
+    inline void scheduler::review_workers() {
+      auto&& elastic = _config.elastic;
+      if (!elastic.enabled || !_review_lock.try_lock()) {
+        return;
+      }
+      XI_SCOPE(exit) {
+        _review_lock.unlock();
+      };
+      /// Every worker reports, but once per interval is plenty
+      auto now = hw::monotonic_ns();
+      if (now - _last_review_ns < u64(elastic.sustain.count()) / 16) {
+        return;
+      }
+      _last_review_ns = now;
+
+      usize admitted = 0;
+      u64 busy       = 0;
+      for (auto idx : range::to(_workers.size())) {
+        if (!_admitted.contains(idx)) {
+          continue;
+        }
+        ++admitted;
+        /// Parked workers don't report, and aren't busy anyway
+        if (!_parked_workers.contains(idx)) {
+          busy += _workers[idx].load->busy_ratio.load(memory_order_relaxed);
+        }
+      }
+      if (!admitted) {
+        return;
+      }
+      auto sustained = [&](mut< u64 > since) {
+        if (!*since) {
+          *since = now;
+        }
+        return nanoseconds(now - *since) >= elastic.sustain;
+      };
+      /// Only shrink if the rest wouldn't immediately ask to grow again
+      if (admitted > max< usize >(elastic.min_workers, 1) &&
+          busy / (admitted - 1) < elastic.grow_above &&
+          busy / admitted < elastic.shrink_below) {
+        _high_since_ns = 0;
+        if (sustained(edit(_low_since_ns))) {
+          _low_since_ns = 0;
+          /// Highest indices go first, and come back last
+          for (auto idx = _workers.size(); idx-- > 0;) {
+            if (_admitted.contains(idx)) {
+              return _retire_locked(idx);
+            }
+          }
+        }
+      } else if (busy / admitted > elastic.grow_above &&
+                 admitted < _workers.size()) {
+        _low_since_ns = 0;
+        if (sustained(edit(_high_since_ns))) {
+          _high_since_ns = 0;
+          for (auto idx : range::to(_workers.size())) {
+            if (!_admitted.contains(idx)) {
+              return _readmit_locked(idx);
+            }
+          }
+        }
+      } else {
+        _low_since_ns  = 0;
+        _high_since_ns = 0;
+      }
+    }
+
+    /// Runs on the retiring worker, which no longer gets new work but may
+    /// still have had some placed on it in the meantime
+    inline void scheduler::_retire(mut< worker > w) {
+      auto idx     = w->index();
+      auto& w_ctrl = _workers[idx];
+      auto& spot   = *w_ctrl.parking;
+
+      worker_queue evicted;
+      w->evacuate(edit(evicted));
+      /// Blocked ports stay with our netpoller, running workers poll it
+      /// on our behalf until they fire
+      _lend_ports(idx);
+      _running_workers.fetch_sub(1, memory_order_acq_rel);
+      spot.state.store(worker_state::RETIRED, memory_order_seq_cst);
+      atomic_thread_fence(memory_order_seq_cst);
+      _hand_off(edit(evicted));
+
+      while (spot.retire.load(memory_order_acquire)) {
+        if (!w_ctrl.input_queue->is_empty()) {
+          w_ctrl.input_queue->dequeue_into(edit(evicted),
+                                           numeric_limits< usize >::max());
+          _hand_off(edit(evicted));
+          continue;
+        }
+        spot.thread_parker.park(steady_clock::time_point::max());
+      }
+
+      spot.state.store(worker_state::RUNNING, memory_order_release);
+      _running_workers.fetch_add(1, memory_order_acq_rel);
+      _reclaim_ports(idx);
+    }
+
+    /// Some worker has published surplus work, wake up a parked
+    /// worker so that it can steal it.
+    inline void scheduler::work_available() {
+      _first_parked_worker(_local_workers()).map(
+          [this](auto w) { _unpark(w); });
+    }
+
+    inline bool scheduler::_steal_into(mut< worker > thief) {
+      auto count = _workers.size();
+      if (count < 2) {
+        return false;
+      }
+      auto&& config = _workers[thief->index()].worker_config;
+      auto node     = _workers[thief->index()].numa_node;
+      auto start    = fast_random() % count;
+      /// Victims on our own node first, only then go across nodes
+      for (auto i : range::to(2 * count)) {
+        auto idx    = (start + i) % count;
+        auto remote = i >= count;
+        if (idx == thief->index() ||
+            remote == (_workers[idx].numa_node == node)) {
+          continue;
+        }
+        auto victim = _workers[idx].stealable_queue;
+        if (!is_valid(victim)) {
+          continue;
+        }
+        /// Take half of what's there, within reason
+        auto batch  = min((victim->size() + 1) / 2, config.steal_batch_max);
+        auto stolen = 0ul;
+        for (; stolen < batch; ++stolen) {
+          auto r = victim->steal();
+          if (r.is_none()) {
+            break;
+          }
+          thief->ready_queue()->enqueue(r.unwrap());
+        }
+        if (stolen > 0) {
+          return true;
+        }
+      }
+      return false;
     }
 
     inline void scheduler::_park(mut< worker > w) {
       auto idx     = w->index();
       auto& w_ctrl = _workers[idx];
+      auto& spot   = *w_ctrl.parking;
+
+      /// Sleep no longer than the earliest local sleeper
+      auto deadline = w->next_wakeup();
+      /// If this is the last worker running, then park it in the shared
+      /// netpoller, where it watches ports of all workers as well as long
+      /// sleepers. Everybody else parks its thread.
+      auto last = 1 == _running_workers.fetch_sub(1, memory_order_acq_rel);
+      if (last) {
+        deadline = min(deadline, _central_sleep_queue.next_item());
+      }
+      /// Only one worker at a time may block in the shared netpoller, as
+      /// its timer can only be armed for a single deadline. A worker
+      /// that was woken up can be the last one again before the
+      /// previous one returns from there.
+      auto state = worker_state::PARKED_THREAD;
+      if (last && _netpoller_lock.try_lock()) {
+        state = worker_state::PARKED_NETPOLL;
+      }
+      XI_TRACE(*w->trace(), PARK, static_cast< u64 >(state));
+      _lend_ports(idx);
+      spot.state.store(state, memory_order_seq_cst);
+      _parked_workers.insert(idx);
+      atomic_thread_fence(memory_order_seq_cst);
 
-      auto park_idx = 1ul << idx;
-      /// If this is the last worker running, then park
-      /// it in netpoller, otherwise park its thread.
-      // printf("%p parking in netpoll.\n", pthread_self());
-      _parked_workers.fetch_or(park_idx, memory_order_acq_rel);
-      w_ctrl.state = worker_state::PARKED_NETPOLL;
-      w_ctrl.poller->blocking_poll_into(w_ctrl.port_queue, 1);
-      // if (park_idx ==
-      //     _active_workers.fetch_and(~park_idx, memory_order_acq_rel)) {
-      //   /// This is the last non-parked worker
-      //   w_ctrl.state = worker_state::PARKED_NETPOLL;
-      //   printf("%p parking in netpoll.\n", pthread_self());
-      //   _netpoller->blocking_poll_into(w_ctrl.port_queue, 1);
-      // } else {
-      //   w_ctrl.state = worker_state::PARKED_THREAD;
-      //   auto lock    = make_unique_lock(*w_ctrl.worker_mutex);
-      //   printf("%p parking in thread.\n", pthread_self());
-      //   w_ctrl.worker_cv->wait(lock);
-      // }
-      w_ctrl.state = worker_state::RUNNING;
-      // _active_workers.fetch_or(park_idx, memory_order_release);
-      _parked_workers.fetch_and(~park_idx, memory_order_release);
-      // printf("%p un-parking.\n", pthread_self());
-    }
-
-    inline auto scheduler::_worker_for_job(ref< resumable_builder >)
+      /// Work may have been handed to us before we announced ourselves,
+      /// or we may have been asked to retire
+      worker_queue ready;
+      if (w_ctrl.input_queue->is_empty() &&
+          !spot.retire.load(memory_order_relaxed)) {
+        if (state == worker_state::PARKED_NETPOLL) {
+          /// Our own ports are lent to the shared netpoller as well
+          _netpoller->blocking_poll_into(
+              edit(ready), numeric_limits< usize >::max(), deadline);
+        } else {
+          spot.thread_parker.park(deadline);
+        }
+      }
+      if (state == worker_state::PARKED_NETPOLL) {
+        _netpoller_lock.unlock();
+      }
+
+      spot.state.store(worker_state::RUNNING, memory_order_release);
+      _running_workers.fetch_add(1, memory_order_acq_rel);
+      _parked_workers.erase(idx);
+      _reclaim_ports(idx);
+      XI_TRACE(*w->trace(), WAKE, ready.size());
+      /// We are awake anyway, keep one for ourselves
+      if (!ready.is_empty()) {
+        w_ctrl.port_queue->enqueue(ready.dequeue().unwrap());
+      }
+      _hand_off(edit(ready));
+    }
+
+    /// Wakes up a single worker, by whichever means it parked
+    inline void scheduler::_unpark(mut< worker_control_block > w) {
+#if defined(XI_HAS_TRACE)
+      /// Recorded by the waker, rings only have a single writer
+      if (is_valid(LOCAL_WORKER) && is_valid(w->w)) {
+        XI_TRACE(*LOCAL_WORKER->trace(), UNPARK, w->w->index());
+      }
+#endif
+      switch (w->parking->state.load(memory_order_seq_cst)) {
+        case worker_state::PARKED_NETPOLL:
+          return _netpoller->unblock_one();
+        case worker_state::PARKED_THREAD:
+        case worker_state::RETIRED:
+          return w->parking->thread_parker.unpark();
+        case worker_state::RUNNING:
+        case worker_state::SPINNING:
+          return;
+      }
+    }
+
+    inline void scheduler::_lend_ports(usize idx) {
+      auto&& poller = _workers[idx].poller;
+      /// Whoever polls on our behalf has to know about all of our ports
+      poller->flush();
+      if (poller->pending() > 0) {
+        _parked_on_ports.insert(idx);
+        _netpoller->watch(poller);
+      }
+    }
+
+    /// Once this returns, nobody polls our netpoller but us
+    inline void scheduler::_reclaim_ports(usize idx) {
+      if (_parked_on_ports.contains(idx)) {
+        _netpoller->unwatch(_workers[idx].poller);
+        _parked_on_ports.erase(idx);
+      }
+    }
+
+    /// Spreads out resumables that were made ready outside of the worker
+    /// that is going to run them
+    inline void scheduler::_hand_off(mut< worker_queue > q) {
+      while (!q->is_empty()) {
+        central_enqueue(q->dequeue().unwrap());
+      }
+    }
+
+    inline auto scheduler::_worker_for_job(affinity hint)
         -> mut< worker_control_block > {
       assert(_workers.size() > 0);
-      // TODO: Add worker affinity
+      switch (hint.kind) {
+        case affinity::WORKER: {
+          auto idx = hint.value % _workers.size();
+          if (_admitted.contains(idx)) {
+            return edit(_workers[idx]);
+          }
+          /// Retired, stay as close to it as we can
+          return _least_loaded_worker_on_node(_workers[idx].numa_node);
+        }
+        case affinity::KEY: {
+          /// Fibonacci hashing spreads sequential keys, such as
+          /// connection ids, evenly. Keys only map onto admitted workers,
+          /// so they move when the worker set changes.
+          auto hash  = (hint.value * 11400714819323198485ull) >> 32;
+          auto count = _admitted.count();
+          auto idx   = count ? _admitted.nth(hash % count) : none;
+          if (idx.is_some()) {
+            return edit(_workers[idx.unwrap()]);
+          }
+          break;
+        }
+        case affinity::NUMA_NODE:
+          return _least_loaded_worker_on_node(hint.value);
+        case affinity::ANY:
+          break;
+      }
 
       /// For unaffined processes pick the best worker.
       /// The selection logic is as follows: (1) if any number of
-      /// workers is parked, unpark one and use it, or (2) if no
-      /// workers are parked, use the worker with least amount of
-      /// work last reported.
-      return _first_parked_worker().unwrap_or(
-          [this] { return _least_loaded_worker(); });
+      /// workers is parked, unpark one and use it, preferring our own
+      /// NUMA node, or (2) if no workers are parked, use the worker on
+      /// our node with least amount of work last reported.
+      auto&& local = _local_workers();
+      return _first_parked_worker(local).unwrap_or(
+          [this, &local] { return _least_loaded_worker(local); });
     }
 
-    inline auto scheduler::_first_parked_worker()
+    /// Whoever takes a worker out of the parked set gets to wake it up
+    inline auto scheduler::_first_parked_worker(ref< worker_set > preferred)
         -> opt< mut< worker_control_block > > {
-      while (auto parked = _parked_workers.load(memory_order_acquire)) {
-        usize idx = count_trailing_zeroes(parked);
-        if (parked !=
-            _parked_workers.fetch_and(~(1ul << idx), memory_order_release)) {
-          /// Lost a race, need to start over
-          continue;
-        }
-        assert(idx < _workers.size());
-        // printf("First parked worker is %lu.\n", idx);
-        // printf("Its state is %lu.\n", (usize)_workers[idx].state);
-        return some(edit(_workers[idx]));
+      auto idx = _parked_workers.claim(preferred);
+      if (idx.is_none()) {
+        /// Parked workers that are being retired are left alone
+        idx = _parked_workers.claim(_admitted);
       }
-      // printf("No parked workers.\n");
-      return none;
+      return idx.map([this](usize i) {
+        assert(i < _workers.size());
+        return edit(_workers[i]);
+      });
     }
 
-    inline auto scheduler::_least_loaded_worker()
+    inline auto scheduler::_least_loaded_worker(ref< worker_set > among)
         -> mut< worker_control_block > {
       assert(_workers.size() > 0);
-      // TODO: This is round robin for now, replace with actual load factors
-      thread_local static u64 ROUND_ROBIN = 0;
-      return edit(_workers[ROUND_ROBIN++ % _workers.size()]);
+      auto count = among.count();
+      if (count == 0 && &among != &_admitted) {
+        return _least_loaded_worker(_admitted);
+      }
+      auto fallback = [] { return usize(0); };
+      if (count < 2) {
+        return edit(_workers[among.nth(0).unwrap_or(fallback)]);
+      }
+      /// Power of two choices: sample two distinct workers and take
+      /// the less loaded one, comparing queue depth first and busy
+      /// ratio second.
+      auto rnd    = fast_random();
+      auto pick   = rnd % count;
+      auto first  = among.nth(pick).unwrap_or(fallback);
+      auto second = among.nth((pick + 1 + (rnd >> 32) % (count - 1)) % count)
+                        .unwrap_or([first] { return first; });
+      auto load_of = [this](usize idx) {
+        auto&& load = *_workers[idx].load;
+        return make_pair(load.queue_depth.load(memory_order_relaxed),
+                         load.busy_ratio.load(memory_order_relaxed));
+      };
+      return edit(_workers[load_of(second) < load_of(first) ? second : first]);
+    }
+
+    inline auto scheduler::_least_loaded_worker_on_node(u16 node)
+        -> mut< worker_control_block > {
+      if (node >= _node_workers.size()) {
+        return _least_loaded_worker(_admitted);
+      }
+      /// Workers on a node are few, compare all of them
+      auto&& on_node = _node_workers[node];
+      opt< mut< worker_control_block > > best = none;
+      u32 best_depth = numeric_limits< u32 >::max();
+      for (auto idx : range::to(_workers.size())) {
+        if (!on_node.contains(idx)) {
+          continue;
+        }
+        auto&& w   = _workers[idx];
+        auto depth = w.load->queue_depth.load(memory_order_relaxed);
+        if (depth < best_depth) {
+          best_depth = depth;
+          best       = some(edit(w));
+        }
+      }
+      return best.unwrap_or(
+          [this] { return _least_loaded_worker(_admitted); });
+    }
+
+    inline auto scheduler::_local_workers() const -> ref< worker_set > {
+      if (is_valid(LOCAL_WORKER) && LOCAL_WORKER->index() < _workers.size()) {
+        auto&& local =
+            _node_workers[_workers[LOCAL_WORKER->index()].numa_node];
+        if (!local.is_empty()) {
+          return local;
+        }
+      }
+      return _admitted;
     }
   }
 }
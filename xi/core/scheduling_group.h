@@ -0,0 +1,37 @@
+#pragma once
+
+#include "xi/ext/configure.h"
+
+namespace xi {
+namespace core {
+  namespace v2 {
+
+    /// Class of work a resumable belongs to. Workers run groups in this
+    /// order, each with its own share of the loop budget, so that
+    /// background jobs can't delay request handling.
+    enum class scheduling_group : u8 {
+      LATENCY_CRITICAL,
+      NORMAL,
+      BACKGROUND,
+    };
+
+    enum : usize { SCHEDULING_GROUPS = 3 };
+
+    inline usize index_of(scheduling_group g) {
+      return static_cast< usize >(g);
+    }
+
+    inline char const* name_of(scheduling_group g) {
+      switch (g) {
+        case scheduling_group::LATENCY_CRITICAL:
+          return "latency_critical";
+        case scheduling_group::NORMAL:
+          return "normal";
+        case scheduling_group::BACKGROUND:
+          return "background";
+      }
+      return "unknown";
+    }
+  }
+}
+}
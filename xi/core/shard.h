@@ -8,7 +8,6 @@ namespace xi {
 namespace core {
 
   class message_bus;
-  class deferred_poller;
 
   struct alignas(64) poller : public virtual ownership::unique {
     virtual ~poller()                = default;
@@ -26,7 +25,8 @@ namespace core {
 
     volatile bool _running = false;
     task_queue _task_queue;
-    mut< deferred_poller > _deferred_poller;
+    /// Posted by this shard, moved over to _task_queue on the next poll
+    task_queue _deferred_tasks;
     mut< signals > _signals;
     vector< own< poller > > _pollers;
     own< core::reactor > _reactor;
@@ -79,7 +79,12 @@ namespace core {
 
   template < class F >
   void shard::post(F &&func) {
-    _post_task(make_unique_copy(make_task(forward< F >(func))));
+    assert(this_shard);
+    if (this == this_shard) {
+      _deferred_tasks.submit(forward< F >(func));
+    } else {
+      _post_task(make_unique_copy(make_task(forward< F >(func))));
+    }
   }
 
   template < class F >
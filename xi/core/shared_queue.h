@@ -10,36 +10,132 @@ namespace xi {
 namespace core {
   namespace v2 {
 
+    /// Input of a single worker, fed by any thread.
+    ///
+    /// Built resumables go through an intrusive MPSC stack linked
+    /// through their handoff hook: pushing is a single atomic exchange
+    /// and needs no allocation. The owning worker takes the whole chain
+    /// with another exchange, puts it back into push order and splices
+    /// it onto its own queue. Builders still go through a node based
+    /// queue and are built by the receiving worker.
     class shared_queue : public ownership::unique {
+      using hook_type = detail::handoff_hook_type;
+
       enum { INITIAL_CAPACITY = 256 };
       lockfree::queue< resumable_builder* > _queue{INITIAL_CAPACITY};
 
+      /// Most recently pushed first, null when empty. A producer links
+      /// the previous head behind its item right after swapping it in,
+      /// until then the item points at _unlinked.
+      alignas(64) atomic< hook_type* > _head{nullptr};
+      hook_type _unlinked;
+
     public:
+      shared_queue() = default;
+      ~shared_queue();
+
       void enqueue(own< resumable_builder >);
+      /// Any thread
+      void enqueue(own< resumable >);
+      /// Owner only. Takes every resumable waiting and up to n builders.
       usize dequeue_into(mut< worker_queue >, usize n);
+      /// Any thread, resumables still being linked count as present
       bool is_empty() const;
+
+    private:
+      usize _drain_into(mut< worker_queue >);
+      /// Waits out a producer between its exchange and its link
+      hook_type* _next_of(mut< hook_type >);
+      static own< resumable > _resumable_of(mut< hook_type >);
     };
 
+    inline shared_queue::~shared_queue() {
+      worker_queue rest;
+      _drain_into(edit(rest));
+      while (rest.dequeue().is_some()) {
+      }
+      resumable_builder* rb;
+      while (_queue.pop(rb)) {
+        own< resumable_builder >{rb}.reset();
+      }
+    }
+
     inline void shared_queue::enqueue(own< resumable_builder > r) {
       assert(nullptr != r);
       _queue.push(r.release());
     }
 
+    inline void shared_queue::enqueue(own< resumable > r) {
+      assert(nullptr != r);
+      auto h = edit(r.release()->handoff_hook);
+      h->next.store(&_unlinked, memory_order_relaxed);
+      auto prev = _head.exchange(h, memory_order_acq_rel);
+      h->next.store(prev, memory_order_release);
+    }
+
     inline usize shared_queue::dequeue_into(mut< worker_queue > q, usize n) {
+      auto cnt = _drain_into(q);
       for ([[gnu::unused]] auto i : range::to(n)) {
         if (_queue.empty()) {
-          return i;
+          return cnt + i;
         }
         _queue.consume_one([&](resumable_builder* r) {
           q->enqueue(r->build());
           own< resumable_builder >{r}.reset();
         });
       }
-      return n;
+      return cnt + n;
     }
 
     inline bool shared_queue::is_empty() const {
-      return _queue.empty();
+      return _queue.empty() && nullptr == _head.load(memory_order_acquire);
+    }
+
+    inline auto shared_queue::_next_of(mut< hook_type > h) -> hook_type* {
+      for (usize attempt = 0;; ++attempt) {
+        auto next = h->next.load(memory_order_acquire);
+        if (XI_LIKELY(&_unlinked != next)) {
+          return next;
+        }
+        /// The producer got preempted, let it finish
+        if (attempt >= 64) {
+          ::std::this_thread::yield();
+        } else {
+          __asm__ volatile("pause" ::: "memory");
+        }
+      }
+    }
+
+    inline usize shared_queue::_drain_into(mut< worker_queue > q) {
+      if (nullptr == _head.load(memory_order_relaxed)) {
+        return 0;
+      }
+      auto h = _head.exchange(nullptr, memory_order_acquire);
+      /// Reverse into push order
+      hook_type* fifo = nullptr;
+      while (h) {
+        auto next = _next_of(h);
+        h->next.store(fifo, memory_order_relaxed);
+        fifo = h;
+        h    = next;
+      }
+      /// One clock read for the whole batch
+      auto now = hw::monotonic_ns();
+      worker_queue batch;
+      while (fifo) {
+        auto next = fifo->next.load(memory_order_relaxed);
+        fifo->next.store(nullptr, memory_order_relaxed);
+        batch.enqueue(_resumable_of(fifo), now);
+        fifo = next;
+      }
+      auto cnt = batch.size();
+      q->splice(edit(batch));
+      return cnt;
+    }
+
+    inline own< resumable > shared_queue::_resumable_of(mut< hook_type > h) {
+      return own< resumable >{intrusive::get_parent_from_member(
+          h, &resumable::handoff_hook)};
     }
   }
 }
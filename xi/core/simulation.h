@@ -0,0 +1,47 @@
+#pragma once
+
+#include "xi/ext/configure.h"
+
+namespace xi {
+namespace core {
+
+  /// Runs worker threads on virtual time, one at a time.
+  ///
+  /// Only the worker holding the baton runs, everybody else waits in
+  /// poll(). Each poll hands the baton to one of the runnable workers,
+  /// picked by a generator seeded in reset(), so that the same seed
+  /// gives the same interleaving. When no worker is runnable, virtual
+  /// time jumps straight to the earliest deadline any of them is waiting
+  /// for, however far away that is.
+  ///
+  /// A run replays exactly as long as work only enters it from inside
+  /// the simulation, or before the first worker polls.
+  class simulation {
+  public:
+    using time_point = steady_clock::time_point;
+
+    /// Starts over at virtual time zero. Nobody gets to run until the
+    /// given number of workers has made its first poll.
+    static void reset(u64 seed, usize workers);
+    static time_point now();
+
+    /// Called by a worker thread before it first polls, returns without
+    /// waiting for the baton. Workers are numbered in the order they
+    /// attach.
+    static usize attach();
+    static void detach(usize id);
+    /// Gives up the baton and returns once it is handed back, which
+    /// happens no later than the deadline, unless woken up earlier. The
+    /// first poll of a worker waits for the baton without holding it.
+    static void poll(usize id, time_point deadline);
+    /// Makes a worker runnable, from any thread
+    static void wake(usize id);
+
+    /// Times the baton has been handed over
+    static u64 steps();
+    /// Every worker is waiting without a deadline, only wake() can get
+    /// the simulation going again
+    static bool is_stuck();
+  };
+}
+}
@@ -4,6 +4,7 @@
 #include "xi/core/detail/intrusive.h"
 #include "xi/core/resumable.h"
 #include "xi/core/resumable_builder.h"
+#include "xi/core/timer_wheel.h"
 #include "xi/core/worker_queue.h"
 #include "xi/util/spin_lock.h"
 
@@ -11,65 +12,32 @@ namespace xi {
 namespace core {
   namespace v2 {
 
-    class local_sleep_queue : public ownership::unique {
-      detail::sleep_queue_type< resumable > _queue;
-      steady_clock::time_point _next_item = steady_clock::time_point::max();
+    /// ~131us resolution, spanning ~36 minutes before cascading
+    /// from the far end
+    using local_sleep_queue = timer_wheel< 17 >;
 
-    public:
-      void enqueue(steady_clock::time_point when, own< resumable >);
-      void dequeue_into(mut< worker_queue >, steady_clock::time_point cutoff);
-      bool is_empty() const;
-      steady_clock::time_point next_item() const;
-    };
-
-    inline void local_sleep_queue::enqueue(steady_clock::time_point when,
-                                           own< resumable > r) {
-      assert(is_valid(r));
-      if (_next_item > when) {
-        _next_item = when;
-      }
-      r->wakeup_time(when);
-      _queue.insert(*(r.release()));
-    }
-
-    inline void local_sleep_queue::dequeue_into(
-        mut< worker_queue > q, steady_clock::time_point cutoff) {
-      if (_next_item > cutoff) {
-        return;
-      }
-
-      auto i   = _queue.begin();
-      auto end = _queue.end();
-      while (i != end) {
-        if (i->wakeup_time() > cutoff) {
-          _next_item = i->wakeup_time();
-          return;
-        }
-        i->wakeup_time(steady_clock::time_point::max());
-        q->enqueue(own< resumable >{&(*i)});
-        i = _queue.erase(i);
-      }
-      // reached the end of the queue
-      _next_item = steady_clock::time_point::max();
-    }
-
-    inline bool local_sleep_queue::is_empty() const {
-      return _queue.empty();
-    }
-
-    inline steady_clock::time_point local_sleep_queue::next_item() const {
-      return _next_item;
-    }
+    /// ~1ms resolution, spanning ~4.9 hours before cascading
+    /// from the far end
+    using central_sleep_queue = timer_wheel< 20 >;
 
+    /// Coarse sleep queue shared by all workers of a scheduler, meant for
+    /// long sleeps. Workers only ever try to drain it, whoever gets the
+    /// lock first does it on behalf of everybody else.
     class shared_sleep_queue : public ownership::unique {
-      local_sleep_queue _queue;
+      central_sleep_queue _queue;
       spin_lock _lock;
+      /// Mirrors _queue.next_item(), readable without taking the lock
+      atomic< steady_clock::rep > _next_item{
+          steady_clock::time_point::max().time_since_epoch().count()};
 
     public:
       void enqueue(steady_clock::time_point, own< resumable >);
-      void dequeue_into(mut< worker_queue >, steady_clock::time_point cutoff);
+      usize dequeue_into(mut< worker_queue >, steady_clock::time_point cutoff);
       bool is_empty() const;
       steady_clock::time_point next_item() const;
+
+    private:
+      void _publish_next_item();
     };
 
     inline void shared_sleep_queue::enqueue(steady_clock::time_point when,
@@ -77,20 +45,35 @@ namespace core {
       assert(is_valid(r));
       auto lock = make_unique_lock(_lock);
       _queue.enqueue(when, move(r));
+      _publish_next_item();
     }
 
-    inline void shared_sleep_queue::dequeue_into(
+    inline usize shared_sleep_queue::dequeue_into(
         mut< worker_queue > q, steady_clock::time_point cutoff) {
-      auto lock = make_unique_lock(_lock);
+      if (cutoff < next_item() || !_lock.try_lock()) {
+        return 0;
+      }
+      XI_SCOPE(exit) {
+        _lock.unlock();
+      };
+      auto before = q->size();
       _queue.dequeue_into(q, cutoff);
+      _publish_next_item();
+      return q->size() - before;
     }
 
     inline bool shared_sleep_queue::is_empty() const {
-      return _queue.is_empty();
+      return next_item() == steady_clock::time_point::max();
     }
 
     inline steady_clock::time_point shared_sleep_queue::next_item() const {
-      return _queue.next_item();
+      return steady_clock::time_point(
+          steady_clock::duration(_next_item.load(memory_order_acquire)));
+    }
+
+    inline void shared_sleep_queue::_publish_next_item() {
+      _next_item.store(_queue.next_item().time_since_epoch().count(),
+                       memory_order_release);
     }
   }
 }
@@ -6,46 +6,73 @@
 
 namespace xi {
 namespace core {
-  namespace v2 {
-    template < class F, class... Args >
-    class generic_resumable_builder : public resumable_builder {
-      tuple< Args... > _args;
-
-    public:
-      generic_resumable_builder(Args&&... args)
-          : _args(forward< Args >(args)...) {
+  namespace detail {
+    /// Runs a callable as the body of a resumable, Base is the v1 or the
+    /// v2 generic_resumable
+    template < class Base, class F >
+    struct delegate_resumable : public Base {
+      delegate_resumable(F&& f) : _f(forward< F >(f)) {
       }
 
-      own< resumable > build() final override {
-        return make< F >(piecewise_construct, move(_args));
-      };
+    private:
+      void call() override {
+        _f();
+      }
+      F _f;
     };
+  }
 
+  namespace v2 {
+    /// Resumables are constructed once, on the spawning thread, and
+    /// handed to a worker as they are.
     template < class F,
                class... Args,
                XI_REQUIRE_DECL(is_base_of< resumable, F >) >
     void spawn(Args&&... args) {
-      runtime.spawn(make< generic_resumable_builder< F, Args... > >(
-          forward< Args >(args)...));
+      runtime.spawn(own< resumable >{make< F >(forward< Args >(args)...)});
     }
 
     template < class F,
                XI_UNLESS_DECL(is_base_of< resumable, F >),
                XI_REQUIRE_DECL(is_callable< F, void() >) >
     void spawn(F&& f) {
-      struct delegate_resumable : public generic_resumable {
-        delegate_resumable(F&& f) : _f(forward< F >(f)) {
-        }
+      using delegate = core::detail::delegate_resumable< generic_resumable, F >;
+      spawn< delegate >(forward< F >(f));
+    }
+
+    template < class F,
+               class... Args,
+               XI_REQUIRE_DECL(is_base_of< resumable, F >) >
+    void spawn_affine(affinity a, Args&&... args) {
+      own< resumable > r = make< F >(forward< Args >(args)...);
+      r->affinity_hint(a);
+      runtime.spawn(move(r));
+    }
+
+    template < class F,
+               XI_UNLESS_DECL(is_base_of< resumable, F >),
+               XI_REQUIRE_DECL(is_callable< F, void() >) >
+    void spawn_affine(affinity a, F&& f) {
+      using delegate = core::detail::delegate_resumable< generic_resumable, F >;
+      spawn_affine< delegate >(a, forward< F >(f));
+    }
 
-      private:
-        void call() {
-          _f();
-        }
-        F _f;
-      };
+    /// Runs in the given scheduling group rather than the normal one
+    template < class F,
+               class... Args,
+               XI_REQUIRE_DECL(is_base_of< resumable, F >) >
+    void spawn_in(scheduling_group g, Args&&... args) {
+      own< resumable > r = make< F >(forward< Args >(args)...);
+      r->group(g);
+      runtime.spawn(move(r));
+    }
 
-      runtime.spawn(make< generic_resumable_builder< delegate_resumable, F > >(
-          forward< F >(f)));
+    template < class F,
+               XI_UNLESS_DECL(is_base_of< resumable, F >),
+               XI_REQUIRE_DECL(is_callable< F, void() >) >
+    void spawn_in(scheduling_group g, F&& f) {
+      using delegate = core::detail::delegate_resumable< generic_resumable, F >;
+      spawn_in< delegate >(g, forward< F >(f));
     }
   }
 
@@ -65,20 +92,10 @@ namespace core {
              XI_UNLESS_DECL(is_base_of< resumable, F >),
              XI_REQUIRE_DECL(is_callable< F, void() >) >
   void spawn(F&& f) {
-    struct delegate_resumable : public generic_resumable {
-      delegate_resumable(F&& f) : _f(forward< F >(f)) {
-      }
-
-    private:
-      void call() {
-        _f();
-      }
-      F _f;
-    };
-
+    using delegate    = detail::delegate_resumable< generic_resumable, F >;
     auto& coordinator = runtime.coordinator();
     auto maker = [f = move(f)]() mutable {
-      runtime.local_worker().spawn_resumable< delegate_resumable >(move(f));
+      runtime.local_worker().spawn_resumable< delegate >(move(f));
     };
     coordinator.schedule(make_lambda_blocking_resumable(move(maker)));
   }
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "xi/ext/configure.h"
+
+namespace xi {
+namespace core {
+  namespace v2 {
+
+    /// Decides how long an idle worker keeps spinning before it parks.
+    ///
+    /// The window is a multiple of the smoothed gap between arrivals of
+    /// external work, as long as that is short enough to be worth
+    /// waiting for. It collapses to nothing for a whole load report
+    /// interval after one in which spinning ate more than its share of
+    /// the time. All times are monotonic nanoseconds.
+    class spin_policy {
+    public:
+      struct config {
+        u32 gap_multiplier;
+        nanoseconds max_window;
+        /// Share of the load report interval, in 1/1024ths
+        u32 max_burn_ratio;
+      };
+
+    private:
+      config _config;
+      u64 _last_arrival_ns = 0;
+      u64 _arrival_gap_ns  = 0;
+      /// Zero unless spinning
+      u64 _idle_since_ns = 0;
+      nanoseconds _spun  = nanoseconds(0);
+      bool _allowed      = true;
+
+    public:
+      explicit spin_policy(config);
+
+      /// External work showed up
+      void note_arrival(u64 now_ns);
+      /// Starts spinning on the first call, returns whether the window
+      /// has passed since
+      bool should_idle(u64 now_ns);
+      /// Returns how long the spin lasted, zero if there was none
+      nanoseconds end_spin(u64 now_ns);
+      bool is_spinning() const;
+      nanoseconds window() const;
+      /// Closes a load report interval of the given length
+      void end_interval(nanoseconds elapsed);
+    };
+
+    inline spin_policy::spin_policy(config c) : _config(move(c)) {
+    }
+
+    inline void spin_policy::note_arrival(u64 now_ns) {
+      if (_last_arrival_ns) {
+        auto gap        = now_ns - _last_arrival_ns;
+        _arrival_gap_ns = _arrival_gap_ns ? (_arrival_gap_ns * 7 + gap) / 8
+                                          : gap;
+      }
+      _last_arrival_ns = now_ns;
+    }
+
+    inline bool spin_policy::should_idle(u64 now_ns) {
+      if (!_idle_since_ns) {
+        _idle_since_ns = now_ns;
+      }
+      return nanoseconds(now_ns - _idle_since_ns) >= window();
+    }
+
+    inline nanoseconds spin_policy::end_spin(u64 now_ns) {
+      auto spun = nanoseconds(_idle_since_ns ? now_ns - _idle_since_ns : 0);
+      _idle_since_ns = 0;
+      _spun += spun;
+      return spun;
+    }
+
+    inline bool spin_policy::is_spinning() const {
+      return _idle_since_ns != 0;
+    }
+
+    inline nanoseconds spin_policy::window() const {
+      if (!_allowed || !_arrival_gap_ns) {
+        return nanoseconds(0);
+      }
+      auto window = nanoseconds(_arrival_gap_ns * _config.gap_multiplier);
+      /// Next arrival isn't expected soon enough to be worth waiting for
+      if (window > _config.max_window) {
+        return nanoseconds(0);
+      }
+      return window;
+    }
+
+    inline void spin_policy::end_interval(nanoseconds elapsed) {
+      if (elapsed <= nanoseconds(0)) {
+        return;
+      }
+      auto ratio = (_spun.count() << 10) / elapsed.count();
+      _allowed   = ratio <= _config.max_burn_ratio;
+      _spun      = nanoseconds(0);
+    }
+  }
+}
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "xi/ext/configure.h"
+#include "xi/ext/coroutine.h"
+
+namespace xi {
+namespace core {
+  namespace v2 {
+
+    /// Recycles coroutine stacks, so that spawning a resumable doesn't
+    /// cost an mmap/munmap pair and fresh page faults.
+    ///
+    /// Stacks are rounded up to one of SIZE_CLASSES sizes, each with a
+    /// guard page below it. Released stacks are cached per size class,
+    /// the most recently used ones are handed out first as their pages
+    /// are still resident. Beyond the dirty high-water mark, the least
+    /// recently used stacks have their pages returned to the kernel, and
+    /// released stacks beyond the cache limit are unmapped.
+    ///
+    /// A pool is used by a single thread. Stacks may be released to a
+    /// different pool than the one they came from.
+    class stack_pool : public ownership::unique {
+    public:
+      enum : usize {
+        MIN_SIZE_SHIFT  = 14,
+        SIZE_CLASS_STEP = 2,
+        SIZE_CLASSES    = 4,
+        MAX_SIZE = usize(1) << (MIN_SIZE_SHIFT +
+                                (SIZE_CLASSES - 1) * SIZE_CLASS_STEP),
+      };
+
+      struct config {
+        /// Stacks kept per size class, anything above is unmapped
+        usize max_cached;
+        /// Cached stacks per size class allowed to keep their pages
+        usize dirty_high_water;
+      };
+      static config DEFAULT_CONFIG;
+
+      struct stats {
+        /// Allocations served from the cache
+        u64 hits = 0;
+        /// Allocations that had to map a new stack
+        u64 misses = 0;
+        /// Released stacks whose pages were given back to the kernel
+        u64 trimmed = 0;
+        /// Released stacks that were unmapped
+        u64 unmapped = 0;
+      };
+
+    private:
+      struct size_class {
+        /// Clean stacks at the front, dirty ones at the back
+        deque< ::boost::context::stack_context > cached;
+        usize dirty = 0;
+      };
+
+      config _config;
+      array< size_class, SIZE_CLASSES > _classes;
+      stats _stats;
+
+    public:
+      explicit stack_pool(config = DEFAULT_CONFIG);
+      ~stack_pool();
+
+      /// Usable size is at least the requested one, up to MAX_SIZE
+      ::boost::context::stack_context allocate(usize size);
+      void deallocate(::boost::context::stack_context&);
+      ref< stats > statistics() const;
+
+      /// Pool of the calling thread
+      static mut< stack_pool > local();
+
+      static usize class_of(usize size);
+      static usize size_of_class(usize);
+
+    private:
+      static ::boost::context::stack_context _map(usize size);
+      static void _unmap(::boost::context::stack_context&);
+      static void _trim(::boost::context::stack_context&);
+    };
+
+    /// Stack allocator for execution contexts, backed by the pool of the
+    /// thread that allocates or releases the stack
+    struct pooled_stack_allocator {
+      usize size;
+
+      ::boost::context::stack_context allocate();
+      void deallocate(::boost::context::stack_context&);
+    };
+
+    inline ref< stack_pool::stats > stack_pool::statistics() const {
+      return _stats;
+    }
+
+    inline usize stack_pool::class_of(usize size) {
+      for (usize c = 0; c < SIZE_CLASSES - 1; ++c) {
+        if (size <= size_of_class(c)) {
+          return c;
+        }
+      }
+      return SIZE_CLASSES - 1;
+    }
+
+    inline usize stack_pool::size_of_class(usize c) {
+      return usize(1) << (MIN_SIZE_SHIFT + c * SIZE_CLASS_STEP);
+    }
+
+    inline ::boost::context::stack_context pooled_stack_allocator::allocate() {
+      return stack_pool::local()->allocate(size);
+    }
+
+    inline void pooled_stack_allocator::deallocate(
+        ::boost::context::stack_context& ctx) {
+      stack_pool::local()->deallocate(ctx);
+    }
+  }
+}
+}
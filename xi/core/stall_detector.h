@@ -0,0 +1,59 @@
+#pragma once
+
+#include "xi/ext/configure.h"
+
+#include <cstdio>
+
+namespace xi {
+namespace core {
+
+  /// Finds out what a worker thread was doing when a resumable overran
+  /// its quota.
+  ///
+  /// Workers mark the start and end of every slice, which costs a clock
+  /// read and no syscalls. A periodic per-thread timer signal checks the
+  /// slice in progress and, once it has run longer than the quota,
+  /// walks the frame pointers of the stuck thread into one of a fixed
+  /// number of slots, without locks or allocation. Captures are rate limited
+  /// process wide, and are printed later by the worker, outside of
+  /// signal context.
+  class stall_detector {
+  public:
+    enum : usize { MAX_FRAMES = 32, SLOTS = 8 };
+
+    struct config {
+      /// Slices running longer than this are reported
+      nanoseconds quota;
+      /// At most one report per interval, across all threads
+      nanoseconds min_report_interval;
+    };
+    static config DEFAULT_CONFIG;
+
+    struct report {
+      i32 tid;
+      /// How long the slice had been running when it was captured
+      nanoseconds running;
+      i32 depth;
+      array< void*, MAX_FRAMES > frames;
+    };
+
+    /// Takes effect for slices started from now on
+    static void configure(config);
+    static nanoseconds quota();
+    /// Installs the handler for the timer signal. Has to happen before
+    /// any timer is armed.
+    static void install(i32 signo);
+
+    /// Called around each slice by the worker thread
+    static void begin_slice();
+    static void end_slice();
+
+    /// Hands out captured reports, in no particular order
+    static usize drain(function< void(ref< report >) >);
+    /// Prints pending reports, if any, with symbolized backtraces
+    static void report_pending(FILE*);
+    /// Captures lost because all slots were full
+    static u64 dropped();
+  };
+}
+}
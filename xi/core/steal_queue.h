@@ -0,0 +1,74 @@
+#pragma once
+
+#include "xi/ext/configure.h"
+#include "xi/core/resumable.h"
+
+namespace xi {
+namespace core {
+  namespace v2 {
+
+    /// Fixed capacity Chase-Lev work-stealing deque.
+    ///
+    /// Only the owning worker may push, other workers steal from the
+    /// opposite end. The owner drains through the stealing end as well,
+    /// so that the relative order of published resumables is preserved.
+    class steal_queue : public ownership::unique {
+    public:
+      enum : i64 { CAPACITY = 256, MASK = CAPACITY - 1 };
+
+    private:
+      alignas(64) atomic< i64 > _top{0};
+      alignas(64) atomic< i64 > _bottom{0};
+      alignas(64) array< atomic< resumable* >, CAPACITY > _buffer;
+
+    public:
+      /// Owner only
+      void push(own< resumable >);
+      /// Any thread
+      opt< own< resumable > > steal();
+      usize size() const;
+      bool is_empty() const;
+      bool is_full() const;
+    };
+
+    inline void steal_queue::push(own< resumable > r) {
+      assert(is_valid(r));
+      assert(!is_full());
+      auto b = _bottom.load(memory_order_relaxed);
+      _buffer[b & MASK].store(r.release(), memory_order_relaxed);
+      atomic_thread_fence(memory_order_release);
+      _bottom.store(b + 1, memory_order_relaxed);
+    }
+
+    inline opt< own< resumable > > steal_queue::steal() {
+      auto t = _top.load(memory_order_acquire);
+      atomic_thread_fence(memory_order_seq_cst);
+      auto b = _bottom.load(memory_order_acquire);
+      if (t >= b) {
+        return none;
+      }
+      auto r = _buffer[t & MASK].load(memory_order_relaxed);
+      if (!_top.compare_exchange_strong(
+              t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+        /// Lost a race to another thief
+        return none;
+      }
+      return some(own< resumable >{r});
+    }
+
+    inline usize steal_queue::size() const {
+      auto b = _bottom.load(memory_order_relaxed);
+      auto t = _top.load(memory_order_relaxed);
+      return b > t ? static_cast< usize >(b - t) : 0;
+    }
+
+    inline bool steal_queue::is_empty() const {
+      return 0 == size();
+    }
+
+    inline bool steal_queue::is_full() const {
+      return size() >= CAPACITY;
+    }
+  }
+}
+}
@@ -6,47 +6,247 @@
 namespace xi {
 namespace core {
 
+  /// FIFO of tasks run by the shard that owns it.
+  ///
+  /// Tasks live in fixed size slots, with room for small closures inline.
+  /// Only closures that don't fit, or can't be moved without throwing,
+  /// are put on the heap. Slots come in chunks linked into a ring that
+  /// grows by a chunk whenever it is full, and consumed chunks are
+  /// reused, so a queue that has warmed up doesn't allocate at all.
   class task_queue {
-    deque< own< task > > _deque;
+  public:
+    enum : usize {
+      INLINE_SIZE = 48,
+      CHUNK_SLOTS = 64,
+    };
+
+  private:
+    struct slot_ops {
+      void (*run)(void *);
+      void (*destroy)(void *);
+      /// Moves into uninitialized storage and destroys the source
+      void (*relocate)(void *from, void *to);
+    };
+
+    /// Chunks come from make_unique, which only guarantees the
+    /// alignment of max_align_t before C++17
+    struct slot {
+      alignas(max_align_t) char storage[INLINE_SIZE];
+      const slot_ops *ops;
+    };
+
+    struct chunk {
+      array< slot, CHUNK_SLOTS > slots;
+      chunk *next = nullptr;
+    };
+
+    struct position {
+      chunk *at   = nullptr;
+      usize index = 0;
+    };
+
+    template < class T >
+    struct inline_task {
+      T value;
+
+      void run() {
+        _invoke(value, is_base_of< task, T >{});
+      }
+    };
+
+    template < class T >
+    struct boxed_task {
+      unique_ptr< T > value;
+
+      void run() {
+        _invoke(*value, is_base_of< task, T >{});
+      }
+    };
+
+    template < class S >
+    struct ops_of {
+      static void run(void *p) {
+        static_cast< S * >(p)->run();
+      }
+      static void destroy(void *p) {
+        static_cast< S * >(p)->~S();
+      }
+      static void relocate(void *from, void *to) {
+        new (to) S(move(*static_cast< S * >(from)));
+        destroy(from);
+      }
+      static constexpr slot_ops OPS = {run, destroy, relocate};
+    };
+
+    /// Relocating a task must not throw, it may be halfway through a
+    /// queue by then
+    template < class T >
+    using fits_inline =
+        meta::bool_type< sizeof(inline_task< T >) <= INLINE_SIZE &&
+                         alignof(T) <= alignof(max_align_t) &&
+                         is_nothrow_move_constructible< T >::value >;
+
+    vector< unique_ptr< chunk > > _chunks;
+    position _head;
+    position _tail;
+    usize _size = 0;
 
   public:
     task_queue() = default;
+    task_queue(task_queue const &) = delete;
+    task_queue &operator=(task_queue const &) = delete;
+    ~task_queue();
 
     template < class W >
     void submit(W &&work) {
-      _submit(forward< W >(work), is_base_of< task, decay_t< W > >{});
+      _emplace(forward< W >(work), fits_inline< decay_t< W > >{});
     }
 
-    void submit(own<task> t) {
-      _deque.emplace_back(move(t));
+    template < class T >
+    void submit(unique_ptr< T > t) {
+      _emplace_slot< boxed_task< T > >(move(t));
     }
 
+    bool is_empty() const;
+    usize size() const;
+    /// Moves every task of the other queue to the back of this one
+    void append(mut< task_queue >);
+    void swap(task_queue &);
+
     void process_tasks() {
-      auto cnt = 0;
-      while (!_deque.empty()) {
+      while (_size > 0) {
+        auto s = _front();
         XI_SCOPE(exit) {
-          _deque.pop_front();
+          s->ops->destroy(s->storage);
+          _pop_front();
         };
-        _deque.front()->run();
-        ++cnt;
+        s->ops->run(s->storage);
       }
-      // std::cout << "processed: " << cnt << std::endl;
     }
 
   private:
+    template < class T >
+    static void _invoke(T &t, meta::true_type) {
+      t.run();
+    }
+    template < class T >
+    static void _invoke(T &t, meta::false_type) {
+      t();
+    }
+
     template < class W >
-    void _submit(W &&work, meta::false_type) {
-      _push_task(make_task(forward< W >(work)));
+    void _emplace(W &&work, meta::true_type) {
+      _emplace_slot< inline_task< decay_t< W > > >(forward< W >(work));
     }
     template < class W >
-    void _submit(W &&work, meta::true_type) {
-      _push_task(forward< W >(work));
+    void _emplace(W &&work, meta::false_type) {
+      _emplace_slot< boxed_task< decay_t< W > > >(
+          make_unique< decay_t< W > >(forward< W >(work)));
     }
-    template < class T >
-    void _push_task(T &&t) {
-      _deque.emplace_back(make_unique< decay_t< T > >(forward< T >(t)));
-      // std::cout << "queue size: " << _deque.size() << std::endl;
+
+    template < class S, class... A >
+    void _emplace_slot(A &&... args) {
+      auto s = _back();
+      new (s->storage) S{forward< A >(args)...};
+      s->ops = &ops_of< S >::OPS;
+      _push_back();
     }
+
+    mut< slot > _front();
+    /// Free slot at the back, grows the ring if there is none
+    mut< slot > _back();
+    void _push_back();
+    void _pop_front();
+    chunk *_add_chunk_after(chunk *);
   };
+
+  template < class S >
+  constexpr task_queue::slot_ops task_queue::ops_of< S >::OPS;
+
+  inline task_queue::~task_queue() {
+    while (_size > 0) {
+      auto s = _front();
+      s->ops->destroy(s->storage);
+      _pop_front();
+    }
+  }
+
+  inline bool task_queue::is_empty() const {
+    return _size == 0;
+  }
+
+  inline usize task_queue::size() const {
+    return _size;
+  }
+
+  inline void task_queue::append(mut< task_queue > other) {
+    if (is_empty()) {
+      swap(*other);
+      return;
+    }
+    while (!other->is_empty()) {
+      auto from = other->_front();
+      auto to   = _back();
+      from->ops->relocate(from->storage, to->storage);
+      to->ops = from->ops;
+      _push_back();
+      other->_pop_front();
+    }
+  }
+
+  inline void task_queue::swap(task_queue &other) {
+    ::std::swap(_chunks, other._chunks);
+    ::std::swap(_head, other._head);
+    ::std::swap(_tail, other._tail);
+    ::std::swap(_size, other._size);
+  }
+
+  inline auto task_queue::_front() -> mut< slot > {
+    assert(_size > 0);
+    return &_head.at->slots[_head.index];
+  }
+
+  inline auto task_queue::_back() -> mut< slot > {
+    if (XI_UNLIKELY(!_tail.at)) {
+      _tail.at = _head.at = _add_chunk_after(nullptr);
+    } else if (_tail.index == CHUNK_SLOTS) {
+      /// The next chunk is still being consumed
+      if (_tail.at->next == _head.at) {
+        _add_chunk_after(_tail.at);
+      }
+      _tail.at    = _tail.at->next;
+      _tail.index = 0;
+    }
+    return &_tail.at->slots[_tail.index];
+  }
+
+  inline void task_queue::_push_back() {
+    ++_tail.index;
+    ++_size;
+  }
+
+  inline void task_queue::_pop_front() {
+    --_size;
+    if (_size == 0) {
+      /// Start over at the front of whichever chunk we are in
+      _head.index = _tail.index = 0;
+      _tail.at = _head.at;
+    } else if (++_head.index == CHUNK_SLOTS) {
+      _head.at    = _head.at->next;
+      _head.index = 0;
+    }
+  }
+
+  inline auto task_queue::_add_chunk_after(chunk *prev) -> chunk * {
+    _chunks.emplace_back(make_unique< chunk >());
+    auto c = _chunks.back().get();
+    if (prev) {
+      c->next    = prev->next;
+      prev->next = c;
+    } else {
+      c->next = c;
+    }
+    return c;
+  }
 }
 }
@@ -0,0 +1,270 @@
+#pragma once
+
+#include "xi/ext/configure.h"
+#include "xi/core/detail/intrusive.h"
+#include "xi/core/resumable.h"
+#include "xi/core/worker_queue.h"
+
+namespace xi {
+namespace core {
+  namespace v2 {
+
+    /// Hierarchical timing wheel of sleeping resumables.
+    ///
+    /// Time is split into ticks of 2^TICK_SHIFT nanoseconds. Each of the
+    /// LEVELS levels has SLOTS slots, every level covering SLOTS times
+    /// the range of the one below it. Resumables are linked into slots
+    /// through their sleep hook, so insertion and cancellation are O(1),
+    /// and are cascaded towards level 0 as their expiry gets closer.
+    /// Expiry is rounded up to a tick, so a resumable is never woken
+    /// before its wakeup time, and at most one tick after it.
+    template < u8 TICK_SHIFT >
+    class timer_wheel : public ownership::unique {
+      enum : u64 {
+        LEVELS    = 4,
+        SLOT_BITS = 6,
+        SLOTS     = 1 << SLOT_BITS,
+        SLOT_MASK = SLOTS - 1,
+        MAX_TICKS = 1ull << (LEVELS * SLOT_BITS),
+      };
+
+      using slot_type = detail::timer_slot_type< resumable >;
+
+      array< array< slot_type, SLOTS >, LEVELS > _slots;
+      array< u64, LEVELS > _occupied = {};
+      /// Next tick to be processed
+      u64 _current_tick = 0;
+      /// Lower bound of the next tick that has anything to do
+      u64 _next_tick = numeric_limits< u64 >::max();
+      usize _size    = 0;
+
+    public:
+      timer_wheel();
+
+      void enqueue(steady_clock::time_point when, own< resumable >);
+      void dequeue_into(mut< worker_queue >, steady_clock::time_point cutoff);
+      own< resumable > cancel(mut< resumable >);
+      /// Takes out every resumable, leaving their wakeup time intact
+      template < class F >
+      void drain(F&& f);
+      bool is_empty() const;
+      usize size() const;
+      steady_clock::time_point next_item() const;
+
+      static constexpr nanoseconds resolution();
+
+    private:
+      static u64 _nanoseconds_of(steady_clock::time_point);
+      static u64 _expiry_tick_of(steady_clock::time_point);
+      static u64 _rotate_right(u64 bits, u64 by);
+      void _insert(mut< resumable >);
+      u64 _cascade_tick(u64 level, u64 slot) const;
+      u64 _find_next_tick() const;
+      void _process_tick(mut< worker_queue >);
+      void _cascade(u64 level, u64 slot);
+    };
+
+    template < u8 TICK_SHIFT >
+    inline timer_wheel< TICK_SHIFT >::timer_wheel()
+        : _current_tick(_nanoseconds_of(steady_clock::now()) >> TICK_SHIFT) {
+    }
+
+    template < u8 TICK_SHIFT >
+    inline void timer_wheel< TICK_SHIFT >::enqueue(
+        steady_clock::time_point when, own< resumable > r) {
+      assert(is_valid(r));
+      assert(!r->sleep_hook.is_linked());
+      r->wakeup_time(when);
+      _insert(r.release());
+    }
+
+    template < u8 TICK_SHIFT >
+    inline void timer_wheel< TICK_SHIFT >::dequeue_into(
+        mut< worker_queue > q, steady_clock::time_point cutoff) {
+      /// Only ticks that have fully elapsed are processed
+      auto target = _nanoseconds_of(cutoff) >> TICK_SHIFT;
+      if (target < _current_tick) {
+        return;
+      }
+      while (_next_tick <= target) {
+        /// Nothing happens in between, jump straight to the next tick
+        /// of interest
+        _current_tick = max(_current_tick, _next_tick);
+        _process_tick(q);
+        ++_current_tick;
+        _next_tick = _find_next_tick();
+      }
+      _current_tick = target + 1;
+    }
+
+    template < u8 TICK_SHIFT >
+    inline own< resumable > timer_wheel< TICK_SHIFT >::cancel(
+        mut< resumable > r) {
+      assert(r->sleep_hook.is_linked());
+      /// Unlinking doesn't need the slot it is in. Occupancy bits are
+      /// cleared lazily when the slot is processed.
+      using algorithms = typename slot_type::node_algorithms;
+      auto node        = slot_type::value_traits::to_node_ptr(*r);
+      algorithms::unlink(node);
+      algorithms::init(node);
+      r->wakeup_time(steady_clock::time_point::max());
+      --_size;
+      return own< resumable >{r};
+    }
+
+    template < u8 TICK_SHIFT >
+    template < class F >
+    inline void timer_wheel< TICK_SHIFT >::drain(F&& f) {
+      for (auto&& level : _slots) {
+        for (auto&& slot : level) {
+          while (!slot.empty()) {
+            auto r = &slot.front();
+            slot.pop_front();
+            --_size;
+            f(own< resumable >{r});
+          }
+        }
+      }
+      _occupied.fill(0);
+      _next_tick = numeric_limits< u64 >::max();
+    }
+
+    template < u8 TICK_SHIFT >
+    inline bool timer_wheel< TICK_SHIFT >::is_empty() const {
+      return 0 == _size;
+    }
+
+    template < u8 TICK_SHIFT >
+    inline usize timer_wheel< TICK_SHIFT >::size() const {
+      return _size;
+    }
+
+    template < u8 TICK_SHIFT >
+    inline steady_clock::time_point timer_wheel< TICK_SHIFT >::next_item()
+        const {
+      if (is_empty()) {
+        return steady_clock::time_point::max();
+      }
+      return steady_clock::time_point(nanoseconds(_next_tick << TICK_SHIFT));
+    }
+
+    template < u8 TICK_SHIFT >
+    constexpr nanoseconds timer_wheel< TICK_SHIFT >::resolution() {
+      return nanoseconds(1ull << TICK_SHIFT);
+    }
+
+    template < u8 TICK_SHIFT >
+    inline u64 timer_wheel< TICK_SHIFT >::_nanoseconds_of(
+        steady_clock::time_point tp) {
+      return static_cast< u64 >(
+          duration_cast< nanoseconds >(tp.time_since_epoch()).count());
+    }
+
+    template < u8 TICK_SHIFT >
+    inline u64 timer_wheel< TICK_SHIFT >::_expiry_tick_of(
+        steady_clock::time_point tp) {
+      enum : u64 { ROUND = (1ull << TICK_SHIFT) - 1 };
+      auto ns = _nanoseconds_of(tp);
+      if (ns > numeric_limits< u64 >::max() - ROUND) {
+        return numeric_limits< u64 >::max() >> TICK_SHIFT;
+      }
+      return (ns + ROUND) >> TICK_SHIFT;
+    }
+
+    template < u8 TICK_SHIFT >
+    inline u64 timer_wheel< TICK_SHIFT >::_rotate_right(u64 bits, u64 by) {
+      return by ? (bits >> by) | (bits << (64 - by)) : bits;
+    }
+
+    template < u8 TICK_SHIFT >
+    inline void timer_wheel< TICK_SHIFT >::_insert(mut< resumable > r) {
+      auto tick  = max(_expiry_tick_of(r->wakeup_time()), _current_tick);
+      auto delta = tick - _current_tick;
+      if (delta >= MAX_TICKS) {
+        /// Parked at the far end of the wheel and re-inserted as it
+        /// cascades down
+        delta = MAX_TICKS - 1;
+        tick  = _current_tick + delta;
+      }
+      u64 level =
+          delta < SLOTS ? 0 : (63 - count_leading_zeroes(delta)) / SLOT_BITS;
+      u64 slot = (tick >> (level * SLOT_BITS)) & SLOT_MASK;
+      _slots[level][slot].push_back(*r);
+      _occupied[level] |= 1ull << slot;
+      _next_tick = min(_next_tick, level ? _cascade_tick(level, slot) : tick);
+      ++_size;
+    }
+
+    template < u8 TICK_SHIFT >
+    inline u64 timer_wheel< TICK_SHIFT >::_cascade_tick(u64 level,
+                                                        u64 slot) const {
+      if (0 == level) {
+        return _current_tick + ((slot - _current_tick) & SLOT_MASK);
+      }
+      auto shift = level * SLOT_BITS;
+      /// First block of this level starting at or after the current tick
+      auto block = (_current_tick + (1ull << shift) - 1) >> shift;
+      return (block + ((slot - block) & SLOT_MASK)) << shift;
+    }
+
+    template < u8 TICK_SHIFT >
+    inline u64 timer_wheel< TICK_SHIFT >::_find_next_tick() const {
+      auto next = numeric_limits< u64 >::max();
+      if (is_empty()) {
+        return next;
+      }
+      for (u64 level = 0; level < LEVELS; ++level) {
+        if (!_occupied[level]) {
+          continue;
+        }
+        auto shift  = level * SLOT_BITS;
+        auto first  = (_current_tick + (1ull << shift) - 1) >> shift;
+        auto offset = count_trailing_zeroes(
+            _rotate_right(_occupied[level], first & SLOT_MASK));
+        next = min(next, _cascade_tick(level, (first + offset) & SLOT_MASK));
+      }
+      return next;
+    }
+
+    template < u8 TICK_SHIFT >
+    inline void timer_wheel< TICK_SHIFT >::_process_tick(
+        mut< worker_queue > q) {
+      /// Cascade every level whose block starts at this tick, highest
+      /// first, so that everything due lands in level 0 in time
+      auto aligned = 0ull;
+      for (u64 level = 1; level < LEVELS; ++level) {
+        if (_current_tick & ((1ull << (level * SLOT_BITS)) - 1)) {
+          break;
+        }
+        aligned = level;
+      }
+      for (auto level = aligned; level > 0; --level) {
+        _cascade(level, (_current_tick >> (level * SLOT_BITS)) & SLOT_MASK);
+      }
+      auto slot = _current_tick & SLOT_MASK;
+      auto&& expired = _slots[0][slot];
+      _occupied[0] &= ~(1ull << slot);
+      while (!expired.empty()) {
+        auto r = &expired.front();
+        expired.pop_front();
+        --_size;
+        r->wakeup_time(steady_clock::time_point::max());
+        q->enqueue(own< resumable >{r});
+      }
+    }
+
+    template < u8 TICK_SHIFT >
+    inline void timer_wheel< TICK_SHIFT >::_cascade(u64 level, u64 slot) {
+      slot_type pending;
+      pending.splice(pending.end(), _slots[level][slot]);
+      _occupied[level] &= ~(1ull << slot);
+      while (!pending.empty()) {
+        auto r = &pending.front();
+        pending.pop_front();
+        --_size;
+        _insert(r);
+      }
+    }
+  }
+}
+}
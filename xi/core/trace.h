@@ -0,0 +1,128 @@
+#pragma once
+
+#include "xi/ext/configure.h"
+#include "xi/hw/tsc.h"
+
+namespace xi {
+namespace core {
+  namespace v2 {
+
+    /// Scheduler events that can be traced. Meaning of the argument is
+    /// given next to each kind.
+    enum class trace_kind : u8 {
+      /// Resumables taken from the shared queue
+      DEQUEUE,
+      /// Resumables made ready by a netpoller
+      NETPOLL,
+      /// Address of the resumable about to run
+      RESUME,
+      /// Resumable finished, no argument
+      DONE,
+      /// Resumable yielded to go to the back of the queue, no argument
+      RESCHEDULE,
+      /// Resumable blocked on the given fd
+      BLOCK_PORT,
+      /// Resumable blocked for the given number of nanoseconds
+      BLOCK_SLEEP,
+      /// Worker parked, argument is its worker_state
+      PARK,
+      /// Worker woke up, argument is the number of events it brought
+      WAKE,
+      /// Index of the worker this one has unparked
+      UNPARK,
+    };
+
+    struct trace_event {
+      u64 timestamp_ns;
+      u64 arg : 56;
+      u64 kind : 8;
+    };
+    static_assert(sizeof(trace_event) == 16, "Trace events must stay small");
+
+    /// Fixed size buffer of the most recent events of a single worker.
+    /// Recording never blocks or allocates, old events get overwritten.
+    class trace_ring : public ownership::unique {
+    public:
+      enum : usize { CAPACITY = 1 << 14, MASK = CAPACITY - 1 };
+
+    private:
+      vector< trace_event > _events;
+      atomic< u64 > _head{0};
+
+    public:
+      trace_ring();
+
+      /// Must only be called by the owning worker
+      void record(trace_kind, u64 arg);
+      /// Retained events, oldest first. Safe to call from any thread,
+      /// events overwritten while copying are dropped.
+      vector< trace_event > snapshot() const;
+    };
+
+    /// Events of one thread, as shown on its own track
+    struct trace_thread {
+      u64 id;
+      vector< trace_event > events;
+    };
+
+    extern atomic< bool > TRACE_ENABLED;
+
+    inline bool is_tracing_enabled() {
+      return TRACE_ENABLED.load(memory_order_relaxed);
+    }
+
+    inline void enable_tracing(bool enabled) {
+      TRACE_ENABLED.store(enabled, memory_order_relaxed);
+    }
+
+    /// Writes events in Chrome trace format, which can be opened in
+    /// chrome://tracing or Perfetto
+    void write_chrome_trace(::std::ostream&, ref< vector< trace_thread > >);
+
+    inline trace_ring::trace_ring() : _events(CAPACITY) {
+    }
+
+    inline void trace_ring::record(trace_kind kind, u64 arg) {
+      auto head    = _head.load(memory_order_relaxed);
+      auto&& event = _events[head & MASK];
+      event.timestamp_ns = hw::monotonic_ns();
+      event.arg          = arg;
+      event.kind         = static_cast< u8 >(kind);
+      _head.store(head + 1, memory_order_release);
+    }
+
+    inline vector< trace_event > trace_ring::snapshot() const {
+      auto head  = _head.load(memory_order_acquire);
+      auto first = head > CAPACITY ? head - CAPACITY : 0;
+      vector< trace_event > events;
+      events.reserve(head - first);
+      for (auto i = first; i < head; ++i) {
+        events.push_back(_events[i & MASK]);
+      }
+      /// Anything the writer has lapped in the meantime may be torn
+      auto after = _head.load(memory_order_acquire);
+      if (after > first + CAPACITY) {
+        auto lapped = min< u64 >(after - first - CAPACITY, events.size());
+        events.erase(begin(events), begin(events) + lapped);
+      }
+      return events;
+    }
+  }
+}
+}
+
+/// Records a scheduler event on the given ring. Compiles to nothing
+/// unless built with XI_HAS_TRACE, in which case it costs a relaxed load
+/// and a predicted branch while tracing is disabled.
+#if defined(XI_HAS_TRACE)
+#define XI_TRACE(ring, kind, arg)                                              \
+  do {                                                                         \
+    if (XI_UNLIKELY(::xi::core::v2::is_tracing_enabled())) {                   \
+      (ring).record(::xi::core::v2::trace_kind::kind, (arg));                  \
+    }                                                                          \
+  } while (0)
+#else
+#define XI_TRACE(ring, kind, arg)                                              \
+  do {                                                                         \
+  } while (0)
+#endif
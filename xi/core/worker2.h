@@ -1,7 +1,12 @@
 #pragma once
 
 #include "xi/ext/configure.h"
+#include "xi/core/cached_clock.h"
+#include "xi/core/latency_histogram.h"
 #include "xi/core/sleep_queue.h"
+#include "xi/core/spin_policy.h"
+#include "xi/core/steal_queue.h"
+#include "xi/core/trace.h"
 #include "xi/core/worker_queue.h"
 
 namespace xi {
@@ -13,19 +18,85 @@ namespace core {
     class scheduler;
     class execution_budget;
 
+    /// Figures a worker publishes about itself for the scheduler to
+    /// base placement decisions on. Kept on its own cache line, as it is
+    /// written by the owner and read by everyone else.
+    struct alignas(64) worker_load {
+      /// Resumables ready to run, including published surplus
+      atomic< u32 > queue_depth{0};
+      /// Smoothed share of time spent running resumables, in 1/1024ths
+      atomic< u32 > busy_ratio{0};
+    };
+
+    struct worker_stats_snapshot {
+      latency_snapshot run_slice;
+      latency_snapshot queue_wait;
+      latency_snapshot poll_to_dispatch;
+      array< u64, SCHEDULING_GROUPS > group_run_ns = {};
+      u64 spin_hits = 0;
+      u64 parks     = 0;
+      u64 spin_ns   = 0;
+
+      void merge(ref< worker_stats_snapshot >);
+    };
+
+    /// Latency distributions of the resumables a worker runs
+    struct worker_stats {
+      /// Time spent inside a single resume
+      latency_histogram run_slice;
+      /// Time from becoming ready to being resumed
+      latency_histogram queue_wait;
+      /// Time from a port event being polled to being resumed
+      latency_histogram poll_to_dispatch;
+      /// Total time spent running each scheduling group, for capacity
+      /// planning. Written by the worker only.
+      array< atomic< u64 >, SCHEDULING_GROUPS > group_run_ns = {};
+      /// Idle spins that ended with work showing up
+      atomic< u64 > spin_hits{0};
+      /// Idle spins that ended with the worker going to the scheduler
+      atomic< u64 > parks{0};
+      /// Total time spent spinning while idle
+      atomic< u64 > spin_ns{0};
+
+      void record_run(scheduling_group, nanoseconds);
+      void record_spin(nanoseconds, bool found_work);
+      worker_stats_snapshot snapshot() const;
+    };
+
     class worker final {
     public:
       struct config {
         usize netpoll_max;
         usize scheduler_dequeue_max;
-        usize loop_budget_allocation;
-        usize max_loop_budget_allocation;
-        usize isolation_budget_allocation;
+        nanoseconds loop_budget_allocation;
+        nanoseconds max_loop_budget_allocation;
+        nanoseconds isolation_budget_allocation;
+        /// Rounds always spun before going idle
         usize nr_spins_before_idle;
+        /// Ready resumables kept private before the surplus is
+        /// published for stealing
+        usize stealable_threshold;
+        /// Upper bound on resumables taken from a victim at once
+        usize steal_batch_max;
+        /// Length of the busy ratio sampling window
+        nanoseconds load_report_interval;
+        /// How long the cached time is interpolated before it is read
+        /// from steady_clock again
+        nanoseconds clock_resync_interval;
         struct {
           nanoseconds upper_bound_ready_queue;
           nanoseconds upper_bound_fast_queue;
         } timer_bounds;
+        /// Relative shares of the loop budget each scheduling group is
+        /// guaranteed, in group order. Budget a group leaves unused goes
+        /// to the others in order of priority, as does all of it if every
+        /// weight is zero.
+        array< u32, SCHEDULING_GROUPS > group_weights;
+        /// Past the minimum number of rounds, an idle worker keeps
+        /// spinning for a multiple of the smoothed gap between arrivals
+        /// of external work, if that is short enough to be worth waiting
+        /// for and spinning hasn't been eating too much of its time.
+        spin_policy::config spin;
       };
       static config DEFAULT_CONFIG;
 
@@ -38,8 +109,23 @@ namespace core {
       config _config;
 
       worker_queue _port_queue;
+      /// Everything made ready lands here first and is sorted into its
+      /// group's queue before running
       worker_queue _ready_queue;
+      array< worker_queue, SCHEDULING_GROUPS > _group_queues;
+      steal_queue _steal_queue;
       local_sleep_queue _local_sleep_queue;
+      cached_clock _clock;
+
+      worker_load _load;
+      /// Set once run() starts
+      u64 _load_window_start        = 0;
+      nanoseconds _load_window_busy = nanoseconds(0);
+      spin_policy _spin;
+      worker_stats _stats;
+#if defined(XI_HAS_TRACE)
+      trace_ring _trace;
+#endif
 
     public:
       worker(mut< netpoller > n,
@@ -57,8 +143,30 @@ namespace core {
       u64 index() const;
       mut< worker_queue > port_queue();
       mut< worker_queue > ready_queue();
+      mut< steal_queue > stealable_queue();
+      mut< worker_load > load();
+      mut< worker_stats > stats();
+#if defined(XI_HAS_TRACE)
+      mut< trace_ring > trace();
+#endif
+      /// Earliest time one of the local sleepers is due
+      steady_clock::time_point next_wakeup() const;
+      /// Gives up everything the worker holds, before it is retired.
+      /// Ready work ends up in the given queue, sleepers are moved to the
+      /// scheduler with their wakeup time.
+      void evacuate(mut< worker_queue >);
 
     private:
+      void _report_load(nanoseconds busy);
+      bool _has_ready() const;
+      usize _ready_count() const;
+      void _sort_ready();
+      bool _run_groups(mut< execution_budget >, nanoseconds allocation);
+      void _note_arrival();
+      bool _should_idle(u64 spins);
+      void _end_spin(u64 now_ns, bool found_work);
+      void _publish_surplus();
+      void _reclaim_published();
       void _block_resumable_on_sleep(own< resumable >, nanoseconds);
       void _run_task_from_queue(mut< worker_queue >, mut< execution_budget >);
     };
@@ -92,6 +200,70 @@ namespace core {
       return edit(_ready_queue);
     }
 
+    inline mut< steal_queue > worker::stealable_queue() {
+      return edit(_steal_queue);
+    }
+
+    inline mut< worker_load > worker::load() {
+      return edit(_load);
+    }
+
+    inline mut< worker_stats > worker::stats() {
+      return edit(_stats);
+    }
+
+#if defined(XI_HAS_TRACE)
+    inline mut< trace_ring > worker::trace() {
+      return edit(_trace);
+    }
+#endif
+
+    inline void worker_stats_snapshot::merge(
+        ref< worker_stats_snapshot > other) {
+      run_slice.merge(other.run_slice);
+      queue_wait.merge(other.queue_wait);
+      poll_to_dispatch.merge(other.poll_to_dispatch);
+      for (auto g : range::to< usize >(SCHEDULING_GROUPS)) {
+        group_run_ns[g] += other.group_run_ns[g];
+      }
+      spin_hits += other.spin_hits;
+      parks += other.parks;
+      spin_ns += other.spin_ns;
+    }
+
+    inline void worker_stats::record_run(scheduling_group g, nanoseconds d) {
+      run_slice.record(d);
+      auto&& total = group_run_ns[index_of(g)];
+      total.store(total.load(memory_order_relaxed) + d.count(),
+                  memory_order_relaxed);
+    }
+
+    inline void worker_stats::record_spin(nanoseconds d, bool found_work) {
+      auto&& outcome = found_work ? spin_hits : parks;
+      outcome.store(outcome.load(memory_order_relaxed) + 1,
+                    memory_order_relaxed);
+      spin_ns.store(spin_ns.load(memory_order_relaxed) + d.count(),
+                    memory_order_relaxed);
+    }
+
+    inline worker_stats_snapshot worker_stats::snapshot() const {
+      worker_stats_snapshot s{
+          run_slice.snapshot(), queue_wait.snapshot(),
+          poll_to_dispatch.snapshot(),
+      };
+      for (auto g : range::to< usize >(SCHEDULING_GROUPS)) {
+        s.group_run_ns[g] = group_run_ns[g].load(memory_order_relaxed);
+      }
+      s.spin_hits = spin_hits.load(memory_order_relaxed);
+      s.parks     = parks.load(memory_order_relaxed);
+      s.spin_ns   = spin_ns.load(memory_order_relaxed);
+      return s;
+    }
+
+    inline steady_clock::time_point worker::next_wakeup() const {
+      return _local_sleep_queue.next_item();
+    }
+
     // assigned by scheduler
     extern thread_local mut< worker > LOCAL_WORKER;
   }
@@ -3,6 +3,7 @@
 #include "xi/ext/configure.h"
 #include "xi/core/detail/intrusive.h"
 #include "xi/core/resumable.h"
+#include "xi/hw/tsc.h"
 
 namespace xi {
 namespace core {
@@ -10,16 +11,43 @@ namespace core {
 
     class worker_queue {
       core::detail::ready_queue_type<resumable> _queue;
+      usize _size = 0;
 
     public:
       void enqueue(own< resumable >);
+      /// Same, with the time it became ready already taken
+      void enqueue(own< resumable >, u64 now_ns);
+      /// Moves everything from the other queue to the back of this one
+      void splice(mut< worker_queue >);
       opt< own< resumable > > dequeue();
+      opt< own< resumable > > dequeue_back();
       bool is_empty() const;
+      usize size() const;
     };
 
     inline void worker_queue::enqueue(own< resumable > r) {
       assert(nullptr != r);
+      /// Keep the earliest stamp as the resumable moves between queues
+      if (!r->ready_since()) {
+        r->ready_since(hw::monotonic_ns());
+      }
       _queue.push_back(*(r.release()));
+      ++_size;
+    }
+
+    inline void worker_queue::enqueue(own< resumable > r, u64 now_ns) {
+      assert(nullptr != r);
+      if (!r->ready_since()) {
+        r->ready_since(now_ns);
+      }
+      _queue.push_back(*(r.release()));
+      ++_size;
+    }
+
+    inline void worker_queue::splice(mut< worker_queue > other) {
+      _queue.splice(_queue.end(), other->_queue);
+      _size += other->_size;
+      other->_size = 0;
     }
 
     inline opt< own< resumable > > worker_queue::dequeue() {
@@ -28,13 +56,29 @@ namespace core {
       }
       XI_SCOPE(exit) {
         _queue.pop_front();
+        --_size;
       };
       return some(own< resumable >{&_queue.front()});
     }
 
+    inline opt< own< resumable > > worker_queue::dequeue_back() {
+      if (is_empty()) {
+        return none;
+      }
+      XI_SCOPE(exit) {
+        _queue.pop_back();
+        --_size;
+      };
+      return some(own< resumable >{&_queue.back()});
+    }
+
     inline bool worker_queue::is_empty() const {
       return _queue.empty();
     }
+
+    inline usize worker_queue::size() const {
+      return _size;
+    }
   }
 }
 }
@@ -0,0 +1,149 @@
+#pragma once
+
+#include "xi/ext/configure.h"
+
+namespace xi {
+namespace core {
+  namespace v2 {
+
+    /// Set of worker indices, made of as many 64-bit words as it takes.
+    /// Membership can be changed and queried from any thread, but the
+    /// capacity has to be set before the set is shared.
+    class worker_set : public ownership::unique {
+      enum : usize { WORD_BITS = 64 };
+
+      unique_ptr< atomic< u64 >[] > _words;
+      usize _word_count = 0;
+      usize _capacity   = 0;
+
+    public:
+      worker_set() = default;
+      explicit worker_set(usize capacity);
+      worker_set(worker_set&&) = default;
+      worker_set& operator=(worker_set&&) = default;
+
+      usize capacity() const;
+      /// Returns whether the worker wasn't a member before
+      bool insert(usize idx);
+      /// Returns whether the worker was a member before
+      bool erase(usize idx);
+      bool contains(usize idx) const;
+      bool is_empty() const;
+      usize count() const;
+      /// Member with the given rank, in index order
+      opt< usize > nth(usize n) const;
+      /// Takes out any member, each one goes to a single caller
+      opt< usize > claim();
+      /// Takes out any member that is also in the given set
+      opt< usize > claim(ref< worker_set > among);
+
+    private:
+      static usize _word_of(usize idx);
+      static u64 _bit_of(usize idx);
+    };
+
+    inline worker_set::worker_set(usize capacity)
+        : _words(new atomic< u64 >[(capacity + WORD_BITS - 1) / WORD_BITS])
+        , _word_count((capacity + WORD_BITS - 1) / WORD_BITS)
+        , _capacity(capacity) {
+      for (auto w : range::to(_word_count)) {
+        _words[w].store(0, memory_order_relaxed);
+      }
+    }
+
+    inline usize worker_set::capacity() const {
+      return _capacity;
+    }
+
+    inline bool worker_set::insert(usize idx) {
+      assert(idx < _capacity);
+      auto bit = _bit_of(idx);
+      return !(_words[_word_of(idx)].fetch_or(bit, memory_order_acq_rel) &
+               bit);
+    }
+
+    inline bool worker_set::erase(usize idx) {
+      assert(idx < _capacity);
+      auto bit = _bit_of(idx);
+      return _words[_word_of(idx)].fetch_and(~bit, memory_order_acq_rel) & bit;
+    }
+
+    inline bool worker_set::contains(usize idx) const {
+      return idx < _capacity &&
+             (_words[_word_of(idx)].load(memory_order_acquire) &
+              _bit_of(idx));
+    }
+
+    inline bool worker_set::is_empty() const {
+      for (auto w : range::to(_word_count)) {
+        if (_words[w].load(memory_order_acquire)) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    inline usize worker_set::count() const {
+      usize total = 0;
+      for (auto w : range::to(_word_count)) {
+        total += count_set_bits(_words[w].load(memory_order_relaxed));
+      }
+      return total;
+    }
+
+    inline opt< usize > worker_set::nth(usize n) const {
+      for (auto w : range::to(_word_count)) {
+        auto bits = _words[w].load(memory_order_relaxed);
+        usize in_word = count_set_bits(bits);
+        if (n >= in_word) {
+          n -= in_word;
+          continue;
+        }
+        for (; n > 0; --n) {
+          bits &= bits - 1;
+        }
+        return some(w * WORD_BITS + count_trailing_zeroes(bits));
+      }
+      return none;
+    }
+
+    inline opt< usize > worker_set::claim() {
+      for (auto w : range::to(_word_count)) {
+        auto bits = _words[w].load(memory_order_acquire);
+        while (bits) {
+          auto bit = bits & -bits;
+          if (_words[w].fetch_and(~bit, memory_order_acq_rel) & bit) {
+            return some(w * WORD_BITS + count_trailing_zeroes(bit));
+          }
+          bits = _words[w].load(memory_order_acquire);
+        }
+      }
+      return none;
+    }
+
+    inline opt< usize > worker_set::claim(ref< worker_set > among) {
+      auto words = min(_word_count, among._word_count);
+      for (auto w : range::to(words)) {
+        auto wanted = among._words[w].load(memory_order_relaxed);
+        auto bits   = _words[w].load(memory_order_acquire) & wanted;
+        while (bits) {
+          auto bit = bits & -bits;
+          if (_words[w].fetch_and(~bit, memory_order_acq_rel) & bit) {
+            return some(w * WORD_BITS + count_trailing_zeroes(bit));
+          }
+          bits = _words[w].load(memory_order_acquire) & wanted;
+        }
+      }
+      return none;
+    }
+
+    inline usize worker_set::_word_of(usize idx) {
+      return idx / WORD_BITS;
+    }
+
+    inline u64 worker_set::_bit_of(usize idx) {
+      return u64(1) << (idx % WORD_BITS);
+    }
+  }
+}
+}
@@ -13,5 +13,6 @@ inline namespace ext {
   using ::std::memory_order_seq_cst;
 
   using ::std::atomic_signal_fence;
+  using ::std::atomic_thread_fence;
 } // inline namespace ext
 } // namespace xi
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <boost/intrusive/list.hpp>
+#include <boost/intrusive/parent_from_member.hpp>
 #include <boost/intrusive/set.hpp>
 
 namespace xi {
@@ -18,6 +19,7 @@ inline namespace ext {
     using ::boost::intrusive::safe_link;
     using ::boost::intrusive::auto_unlink;
     using ::boost::intrusive::compare;
+    using ::boost::intrusive::get_parent_from_member;
   }
 }
 }
@@ -33,6 +33,18 @@ inline namespace ext {
     return __builtin_ctzll(x);
   }
 
+  inline constexpr auto count_set_bits(unsigned x) {
+    return __builtin_popcount(x);
+  }
+
+  inline constexpr auto count_set_bits(unsigned long x) {
+    return __builtin_popcountl(x);
+  }
+
+  inline constexpr auto count_set_bits(unsigned long long x) {
+    return __builtin_popcountll(x);
+  }
+
   template < class T >
   class distinct_numeric_type {
     static_assert(::std::is_arithmetic< T >::value,
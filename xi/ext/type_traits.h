@@ -30,6 +30,7 @@ inline namespace ext {
   using ::std::is_enum;
   using ::std::has_virtual_destructor;
   using ::std::is_nothrow_destructible;
+  using ::std::is_nothrow_move_constructible;
   using ::std::is_convertible;
 
   using ::std::aligned_storage_t;
@@ -77,3 +77,14 @@ namespace hw {
 }
 }
 #endif // XI_HAS_HWLOC
+
+namespace xi {
+namespace hw {
+
+  /// Number of NUMA nodes, 1 without NUMA support
+  extern unsigned numa_nodes();
+  /// Memory first touched by the calling thread is placed on the given
+  /// node where possible. No-op without NUMA support.
+  extern void prefer_numa_node(unsigned node);
+}
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "xi/ext/configure.h"
+
+namespace xi {
+namespace hw {
+
+  inline u64 read_tsc() {
+    unsigned int lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((u64)lo) | (((u64)hi) << 32);
+  }
+
+  /// Relation between the TSC and CLOCK_MONOTONIC, established once per
+  /// process. Only an invariant TSC ticks at a constant rate regardless
+  /// of frequency scaling and C-states, otherwise the TSC is not used to
+  /// tell time at all.
+  struct tsc_calibration {
+    enum : u32 { SHIFT = 32 };
+
+    bool invariant;
+    u64 ticks_per_second;
+    /// Nanoseconds per tick, scaled up by 2^SHIFT
+    u64 mult;
+    /// Taken at the same moment, to translate between the two
+    u64 base_tsc;
+    u64 base_ns;
+
+    u64 ticks_to_ns(u64 ticks) const;
+  };
+
+  /// Constant TSC that keeps ticking in deep C-states, as reported by
+  /// cpuid 0x80000007
+  bool has_invariant_tsc();
+  tsc_calibration calibrate_tsc();
+  /// Calibrates on first use, which may take about 10ms. Call it early
+  /// to keep that out of latency sensitive code.
+  ref< tsc_calibration > tsc();
+
+  /// Nanoseconds on the steady_clock time line. Computed from the TSC
+  /// when it is invariant, read through clock_gettime otherwise.
+  u64 monotonic_ns();
+
+  inline u64 tsc_calibration::ticks_to_ns(u64 ticks) const {
+    return static_cast< u64 >(
+        (static_cast< unsigned __int128 >(ticks) * mult) >> SHIFT);
+  }
+
+  inline ref< tsc_calibration > tsc() {
+    static const tsc_calibration CALIBRATION = calibrate_tsc();
+    return CALIBRATION;
+  }
+
+  inline u64 monotonic_ns() {
+    auto&& c = tsc();
+    if (XI_LIKELY(c.invariant)) {
+      return c.base_ns + c.ticks_to_ns(read_tsc() - c.base_tsc);
+    }
+    timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast< u64 >(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+  }
+}
+}
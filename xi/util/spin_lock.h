@@ -29,6 +29,9 @@ public:
     }
     assert(_state.load(memory_order_relaxed) == locked);
   }
+  bool try_lock() {
+    return _state.exchange(locked, memory_order_acquire) == unlocked;
+  }
   void unlock() {
     _state.store(unlocked, memory_order_release);
   }